@@ -0,0 +1,58 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Copyright (c) 2018 The QBICcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark block download: a fresh node syncs a chain from several
+# local peers that all have it, and reports the blocks per second it
+# reached. Run with --blocks and --window to compare settings.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import time
+
+class BlockDownloadTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--blocks", dest="blocks", default=1000, type="int",
+                          help="Number of blocks to sync (default: %default)")
+        parser.add_option("--window", dest="window", default=256, type="int",
+                          help="-blockdownloadwindow of the syncing node (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 4)
+
+    def setup_network(self):
+        # Nodes 0-2 are the peers serving the chain, node 3 downloads it
+        self.nodes = start_nodes(3, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.is_network_split = False
+
+    def run_test(self):
+        blocks = self.options.blocks
+        print("Mining %d blocks" % blocks)
+        for i in range(0, blocks, 100):
+            self.nodes[0].setgenerate(True, min(100, blocks - i))
+        sync_blocks(self.nodes)
+
+        self.nodes.append(start_node(3, self.options.tmpdir, ["-blockdownloadwindow=%d" % self.options.window]))
+        start = time.time()
+        for i in range(3):
+            connect_nodes(self.nodes[3], i)
+
+        while self.nodes[3].getblockcount() < blocks:
+            time.sleep(0.1)
+        elapsed = time.time() - start
+        assert_equal(self.nodes[3].getbestblockhash(), self.nodes[0].getbestblockhash())
+
+        print("Synced %d blocks in %.2f seconds, %.1f blocks/sec (window %d)" %
+              (blocks, elapsed, blocks / elapsed, self.options.window))
+        for peer in self.nodes[3].getpeerinfo():
+            print("  peer %s: %d bytes received" % (peer['addr'], peer['bytesrecv']))
+
+if __name__ == '__main__':
+    BlockDownloadTest().main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Copyright (c) 2018 The QBICcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark the coin database on transactions with many outputs: node 0
+# creates fan-out transactions, then spends their outputs one at a time,
+# flushing the chain state after every block. Reports the bytes written
+# to the coin database while spending, and how long a fresh node takes
+# to sync the resulting chain. Run with --fanout and --rounds to vary it.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import os
+import re
+import time
+
+def coindb_bytes_written(datadir, start_line):
+    # Sum the batch sizes reported by -debug=coindb after start_line
+    total = 0
+    with open(os.path.join(datadir, "regtest", "debug.log")) as f:
+        lines = f.readlines()
+    for line in lines[start_line:]:
+        m = re.search(r"to coin database \((\d+) bytes\)", line)
+        if m:
+            total += int(m.group(1))
+    return total, len(lines)
+
+class CoinsDBTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--fanout", dest="fanout", default=200, type="int",
+                          help="Outputs per fan-out transaction (default: %default)")
+        parser.add_option("--txs", dest="txs", default=10, type="int",
+                          help="Number of fan-out transactions (default: %default)")
+        parser.add_option("--rounds", dest="rounds", default=20, type="int",
+                          help="Blocks spending one output of each fan-out transaction (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-debug=coindb"]])
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.setgenerate(True, 101 + self.options.txs)
+
+        print("Creating %d transactions with %d outputs" % (self.options.txs, self.options.fanout))
+        fanout = []
+        for i in range(self.options.txs):
+            outputs = dict((node.getnewaddress(), Decimal("0.01")) for j in range(self.options.fanout))
+            fanout.append(node.sendmany("", outputs))
+        node.setgenerate(True, 1)
+        node.gettxoutsetinfo()
+
+        spendable = {}
+        for txid in fanout:
+            tx = node.getrawtransaction(txid, 1)
+            spendable[txid] = [v['n'] for v in tx['vout'] if v['value'] == Decimal("0.01")]
+
+        _, start_line = coindb_bytes_written(os.path.join(self.options.tmpdir, "node0"), 0)
+        start = time.time()
+        for r in range(self.options.rounds):
+            for txid in fanout:
+                n = spendable[txid].pop()
+                raw = node.createrawtransaction([{"txid": txid, "vout": n}], {node.getnewaddress(): Decimal("0.009")})
+                node.sendrawtransaction(node.signrawtransaction(raw)["hex"])
+            node.setgenerate(True, 1)
+            # Write the chain state after every block
+            node.gettxoutsetinfo()
+        elapsed = time.time() - start
+        written, _ = coindb_bytes_written(os.path.join(self.options.tmpdir, "node0"), start_line)
+        spends = self.options.rounds * self.options.txs
+        print("Spent %d outputs in %.2f seconds, %d coin database bytes written (%.0f per spend)" %
+              (spends, elapsed, written, float(written) / spends))
+
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug=coindb"]))
+        start = time.time()
+        connect_nodes(self.nodes[1], 0)
+        while self.nodes[1].getblockcount() < node.getblockcount():
+            time.sleep(0.1)
+        elapsed = time.time() - start
+        assert_equal(self.nodes[1].getbestblockhash(), node.getbestblockhash())
+        assert_equal(self.nodes[1].gettxoutsetinfo()['hash_serialized'], node.gettxoutsetinfo()['hash_serialized'])
+        print("Synced %d blocks in %.2f seconds" % (node.getblockcount(), elapsed))
+
+if __name__ == '__main__':
+    CoinsDBTest().main()
@@ -0,0 +1,66 @@
+#!/usr/bin/env python2
+# Copyright (c) 2014 The Bitcoin Core developers
+# Copyright (c) 2018 The QBICcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test mempool persistence: node 0 fills its mempool, prioritises one
+# transaction and restarts. The mempool and the fee delta must survive
+# the restart, while node 1, started with -persistmempool=0, comes back
+# empty. Reports how long savemempool and the reload took; run with
+# --txs to measure a larger pool.
+#
+from test_framework import BitcoinTestFramework
+from util import *
+import os
+import time
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--txs", dest="txs", default=50, type="int",
+                          help="Number of transactions in the mempool (default: %default)")
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, [[], ["-persistmempool=0"]])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.setgenerate(True, 101 + self.options.txs // 100)
+        sync_blocks(self.nodes)
+
+        print("Creating %d transactions" % self.options.txs)
+        txids = [node.sendtoaddress(node.getnewaddress(), Decimal("0.01")) for i in range(self.options.txs)]
+        sync_mempools(self.nodes)
+        assert_equal(len(node.getrawmempool()), self.options.txs)
+        node.prioritisetransaction(txids[0], 0, 1000)
+        fees = node.getrawmempool(True)[txids[0]]['descendantfees']
+
+        start = time.time()
+        node.savemempool()
+        print("savemempool took %.2f seconds" % (time.time() - start))
+        assert(os.path.isfile(os.path.join(self.options.tmpdir, "node0", "regtest", "mempool.dat")))
+
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.nodes = start_nodes(2, self.options.tmpdir, [[], ["-persistmempool=0"]])
+        node = self.nodes[0]
+
+        # The mempool is reloaded in the background
+        start = time.time()
+        while len(node.getrawmempool()) < self.options.txs and time.time() - start < 600:
+            time.sleep(0.1)
+        print("Reloaded %d transactions in %.2f seconds" % (len(node.getrawmempool()), time.time() - start))
+        assert_equal(len(node.getrawmempool()), self.options.txs)
+        assert_equal(node.getrawmempool(True)[txids[0]]['descendantfees'], fees)
+        assert_equal(len(self.nodes[1].getrawmempool()), 0)
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
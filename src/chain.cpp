@@ -9,6 +9,49 @@
 
 using namespace std;
 
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nUsed == CHUNK_ENTRIES) {
+        vChunks.push_back(static_cast<CBlockIndex*>(::operator new(CHUNK_ENTRIES * sizeof(CBlockIndex))));
+        nUsed = 0;
+    }
+    return vChunks.back() + nUsed;
+}
+
+CBlockIndex* CBlockIndexArena::Create()
+{
+    CBlockIndex* pindex = new (Allocate()) CBlockIndex();
+    nUsed++;
+    return pindex;
+}
+
+CBlockIndex* CBlockIndexArena::Create(const CBlock& block)
+{
+    CBlockIndex* pindex = new (Allocate()) CBlockIndex(block);
+    nUsed++;
+    return pindex;
+}
+
+size_t CBlockIndexArena::Size() const
+{
+    return vChunks.empty() ? 0 : (vChunks.size() - 1) * CHUNK_ENTRIES + nUsed;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nEntries = (i + 1 == vChunks.size()) ? nUsed : CHUNK_ENTRIES;
+        for (size_t j = 0; j < nEntries; j++)
+            vChunks[i][j].~CBlockIndex();
+        ::operator delete(vChunks[i]);
+    }
+    vChunks.clear();
+    nUsed = CHUNK_ENTRIES;
+}
+
 /**
  * CChain implementation
  */
@@ -15,6 +15,7 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <array>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -109,24 +110,33 @@ enum BlockStatus {
 class CBlockIndex
 {
 public:
+    // The fields used when walking the index (pprev, pskip, nHeight, nStatus and
+    // nChainWork) come first, so that they share a cache line.
+
     //! pointer to the hash of the block, if any. memory is owned by this CBlockIndex
     const uint256* phashBlock;
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
-    //! pointer to the index of the next block
-    CBlockIndex* pnext;
-
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
-    //ppcoin: trust score of block chain
-    uint256 bnChainTrust;
-
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
+    //! Verification status of this block. See enum BlockStatus
+    unsigned int nStatus;
+
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    uint256 nChainWork;
+
+    //! pointer to the index of the next block
+    CBlockIndex* pnext;
+
+    //ppcoin: trust score of block chain
+    uint256 bnChainTrust;
+
     //! Which # file this block is stored in (blk?????.dat)
     int nFile;
 
@@ -136,9 +146,6 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
-
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
@@ -148,9 +155,6 @@ public:
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
-
     unsigned int nFlags; // ppcoin: block index flags
     enum {
         BLOCK_PROOF_OF_STAKE = (1 << 0), // is proof-of-stake block
@@ -179,9 +183,9 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
     
-    //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    //! zerocoin specific fields, indexed by the position of the denomination in zerocoinDenomList
+    std::array<int64_t, libzerocoin::ZEROCOIN_DENOM_COUNT> nZerocoinSupply;
+    std::array<uint16_t, libzerocoin::ZEROCOIN_DENOM_COUNT> nMintsInBlock;
     
     void SetNull()
     {
@@ -213,10 +217,8 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        nZerocoinSupply.fill(0);
+        nMintsInBlock.fill(0);
     }
 
     CBlockIndex()
@@ -294,14 +296,40 @@ public:
     {
         int64_t nTotal = 0;
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * mapZerocoinSupply.at(denom);
+            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * GetZerocoinSupply(denom);
         }
         return nTotal;
     }
 
+    int64_t GetZerocoinSupply(libzerocoin::CoinDenomination denom) const
+    {
+        int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return i < 0 ? 0 : nZerocoinSupply[i];
+    }
+
+    void AddZerocoinSupply(libzerocoin::CoinDenomination denom, int64_t nCoins)
+    {
+        int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (i >= 0)
+            nZerocoinSupply[i] += nCoins;
+    }
+
+    int GetMintCount(libzerocoin::CoinDenomination denom) const
+    {
+        int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return i < 0 ? 0 : nMintsInBlock[i];
+    }
+
+    void AddMint(libzerocoin::CoinDenomination denom)
+    {
+        int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (i >= 0)
+            nMintsInBlock[i]++;
+    }
+
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        return GetMintCount(denom) > 0;
     }
 
     uint256 GetBlockHash() const
@@ -420,6 +448,127 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/**
+ * Allocates block index entries from large contiguous chunks instead of one heap
+ * object each. Entries created in height order, as when the index is loaded and
+ * while the chain grows, end up next to each other in memory. Entries are only
+ * destroyed when the whole arena is cleared.
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t CHUNK_ENTRIES = 4096;
+    std::vector<CBlockIndex*> vChunks;
+    //! Entries constructed in the last chunk
+    size_t nUsed;
+
+    CBlockIndex* Allocate();
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    void operator=(const CBlockIndexArena&);
+
+public:
+    CBlockIndexArena() : nUsed(CHUNK_ENTRIES) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* Create();
+    CBlockIndex* Create(const CBlock& block);
+    size_t Size() const;
+    void Clear();
+};
+
+/**
+ * Serialize the zerocoin supply of a block index the way the
+ * std::map<CoinDenomination, int64_t> it used to be kept in was.
+ */
+class CZerocoinSupplySerializer
+{
+protected:
+    std::array<int64_t, libzerocoin::ZEROCOIN_DENOM_COUNT>& supply;
+
+public:
+    CZerocoinSupplySerializer(std::array<int64_t, libzerocoin::ZEROCOIN_DENOM_COUNT>& supplyIn) : supply(supplyIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(supply.size()) + supply.size() * (sizeof(int) + sizeof(int64_t));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, supply.size());
+        for (unsigned int i = 0; i < supply.size(); i++) {
+            ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+            ::Serialize(s, supply[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        supply.fill(0);
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t n = 0; n < nSize; n++) {
+            libzerocoin::CoinDenomination denom;
+            int64_t nSupply;
+            ::Unserialize(s, denom, nType, nVersion);
+            ::Unserialize(s, nSupply, nType, nVersion);
+            int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (i >= 0)
+                supply[i] = nSupply;
+        }
+    }
+};
+
+/**
+ * Serialize the per denomination mint counts of a block index as the
+ * std::vector<CoinDenomination> with one entry per mint they used to be.
+ */
+class CZerocoinMintsSerializer
+{
+protected:
+    std::array<uint16_t, libzerocoin::ZEROCOIN_DENOM_COUNT>& mints;
+
+public:
+    CZerocoinMintsSerializer(std::array<uint16_t, libzerocoin::ZEROCOIN_DENOM_COUNT>& mintsIn) : mints(mintsIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        uint64_t nMints = 0;
+        for (unsigned int i = 0; i < mints.size(); i++)
+            nMints += mints[i];
+        return GetSizeOfCompactSize(nMints) + nMints * sizeof(int);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        uint64_t nMints = 0;
+        for (unsigned int i = 0; i < mints.size(); i++)
+            nMints += mints[i];
+        WriteCompactSize(s, nMints);
+        for (unsigned int i = 0; i < mints.size(); i++) {
+            for (unsigned int j = 0; j < mints[i]; j++)
+                ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        mints.fill(0);
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t n = 0; n < nSize; n++) {
+            libzerocoin::CoinDenomination denom;
+            ::Unserialize(s, denom, nType, nVersion);
+            int i = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (i >= 0)
+                mints[i]++;
+        }
+    }
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -480,8 +629,8 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
-            READWRITE(mapZerocoinSupply);
-            READWRITE(vMintDenominationsInBlock);
+            READWRITE(REF(CZerocoinSupplySerializer(nZerocoinSupply)));
+            READWRITE(REF(CZerocoinMintsSerializer(nMintsInBlock)));
         }
 
     }
@@ -79,17 +79,23 @@ static const Checkpoints::CCheckpointData dataRegtest = {
     0,
     100};
 
+static CBigNum ParseZerocoinModulus(const std::string& strModulus, bool fHex)
+{
+    CBigNum bnModulus;
+    if (fHex)
+        bnModulus.SetHex(strModulus);
+    else
+        bnModulus.SetDec(strModulus);
+    return bnModulus;
+}
+
 libzerocoin::ZerocoinParams* CChainParams::Zerocoin_Params(bool useModulusV1) const
 {
     assert(this);
-    static CBigNum bnHexModulus = 0;
-    if (!bnHexModulus)
-        bnHexModulus.SetHex(zerocoinModulus);
-    static libzerocoin::ZerocoinParams ZCParamsHex = libzerocoin::ZerocoinParams(bnHexModulus);
-    static CBigNum bnDecModulus = 0;
-    if (!bnDecModulus)
-        bnDecModulus.SetDec(zerocoinModulus);
-    static libzerocoin::ZerocoinParams ZCParamsDec = libzerocoin::ZerocoinParams(bnDecModulus);
+    // Parse the modulus inside the static initializers, which run exactly once even when the
+    // transaction check threads get here at the same time
+    static libzerocoin::ZerocoinParams ZCParamsHex = libzerocoin::ZerocoinParams(ParseZerocoinModulus(zerocoinModulus, true));
+    static libzerocoin::ZerocoinParams ZCParamsDec = libzerocoin::ZerocoinParams(ParseZerocoinModulus(zerocoinModulus, false));
 
     if (useModulusV1)
         return &ZCParamsHex;
@@ -9,8 +9,10 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
+#include "sync.h"
 #include "uint256.h"
 #include "undo.h"
 
@@ -285,6 +287,16 @@ public:
                 return false;
         return true;
     }
+
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout) {
+            const std::vector<unsigned char>* script = &out.scriptPubKey;
+            ret += memusage::DynamicUsage(*script);
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -400,7 +412,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -423,6 +436,13 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
+    /* Lookups answered from this cache, and those that went to the base view. */
+    mutable uint64_t nCacheHits;
+    mutable uint64_t nCacheMisses;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -458,6 +478,13 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
+    //! Number of lookups answered from the cache and from the base view since creation
+    uint64_t GetCacheHits() const { return nCacheHits; }
+    uint64_t GetCacheMisses() const { return nCacheMisses; }
+
     /** 
      * Amount of qbiccoin coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -483,4 +510,34 @@ private:
     CCoinsMap::const_iterator FetchCoins(const uint256& txid) const;
 };
 
+/**
+ * CCoinsView that holds one flushed batch of changes while it is written to
+ * its base on another thread. BatchWrite only takes the dirty entries (which
+ * requires the previous batch to have been written); Write() then hands them
+ * to the base and drops them. Lookups see the held batch until it is gone.
+ * The base must not modify the map passed to its BatchWrite, as lookups may
+ * read it concurrently (CCoinsViewDB does not).
+ */
+class CCoinsViewBuffered : public CCoinsViewBacked
+{
+protected:
+    mutable CCriticalSection cs;
+    CCoinsMap cacheCoins;
+    uint256 hashBlock;
+
+public:
+    CCoinsViewBuffered(CCoinsView* baseIn);
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const;
+    bool HaveCoins(const uint256& txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+
+    //! Write the held batch to the base view and release it
+    bool Write();
+
+    //! Whether a batch is waiting to be written
+    bool IsEmpty() const;
+};
+
 #endif // BITCOIN_COINS_H
@@ -5,8 +5,16 @@
 #include "leveldbwrapper.h"
 
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <set>
+#include <sstream>
+#include <stdio.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -27,14 +35,60 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CLevelDBOptions::CLevelDBOptions(size_t nCacheSize)
+{
+    nBlockCache = nCacheSize / 2;
+    nWriteBuffer = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    nBloomBits = 10;
+    fCompression = false;
+    nMaxOpenFiles = 64;
+    nBlockSize = 4096;
+}
+
+/** Apply the -dboption=<name>.<option>=<n> settings for the database called name */
+static void ApplyOptionOverrides(const std::string& name, CLevelDBOptions& dboptions)
+{
+    const std::string prefix = name + ".";
+    BOOST_FOREACH (const std::string& strOption, mapMultiArgs["-dboption"]) {
+        if (strOption.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        size_t nEq = strOption.find('=');
+        if (nEq == std::string::npos) {
+            LogPrintf("Ignoring -dboption=%s: expected <db>.<option>=<n>\n", strOption);
+            continue;
+        }
+        std::string strKey = strOption.substr(prefix.size(), nEq - prefix.size());
+        int64_t n = atoi64(strOption.substr(nEq + 1));
+        if (n < 0) {
+            LogPrintf("Ignoring -dboption=%s: negative value\n", strOption);
+            continue;
+        }
+        if (strKey == "cache")
+            dboptions.nBlockCache = n << 20;
+        else if (strKey == "writebuffer")
+            dboptions.nWriteBuffer = n << 20;
+        else if (strKey == "bloombits")
+            dboptions.nBloomBits = n;
+        else if (strKey == "compression")
+            dboptions.fCompression = n != 0;
+        else if (strKey == "maxopenfiles")
+            dboptions.nMaxOpenFiles = n;
+        else if (strKey == "blocksize")
+            dboptions.nBlockSize = n << 10;
+        else
+            LogPrintf("Ignoring -dboption=%s: unknown option\n", strOption);
+    }
+}
+
+static leveldb::Options GetOptions(const CLevelDBOptions& dboptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(dboptions.nBlockCache);
+    options.write_buffer_size = dboptions.nWriteBuffer;
+    options.filter_policy = dboptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dboptions.nBloomBits) : NULL;
+    options.compression = dboptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dboptions.nMaxOpenFiles;
+    options.block_size = dboptions.nBlockSize;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +97,45 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+/** All open databases, for GetLevelDBStats. Never destroyed, as databases may outlive static objects. */
+static boost::mutex& OpenDatabasesMutex()
+{
+    static boost::mutex* pmutex = new boost::mutex();
+    return *pmutex;
+}
+
+static std::set<const CLevelDBWrapper*>& OpenDatabases()
+{
+    static std::set<const CLevelDBWrapper*>* pset = new std::set<const CLevelDBWrapper*>();
+    return *pset;
+}
+
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) : dboptions(nCacheSize)
+{
+    Open(path, fMemory, fWipe);
+}
+
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBOptions& optionsIn, bool fMemory, bool fWipe) : dboptions(optionsIn)
+{
+    Open(path, fMemory, fWipe);
+}
+
+void CLevelDBWrapper::Open(const boost::filesystem::path& path, bool fMemory, bool fWipe)
 {
     penv = NULL;
+    name = path.filename().string();
+    strPath = path.string();
+    nReads = 0;
+    nReadsFound = 0;
+    nIterators = 0;
+    nBatches = 0;
+    nBytesWritten = 0;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    ApplyOptionOverrides(name, dboptions);
+    options = GetOptions(dboptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -66,10 +151,19 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    LogPrint("db", "LevelDB %s: cache=%u writebuffer=%u bloombits=%d compression=%d maxopenfiles=%d blocksize=%u\n",
+        name, dboptions.nBlockCache, dboptions.nWriteBuffer, dboptions.nBloomBits, dboptions.fCompression, dboptions.nMaxOpenFiles, dboptions.nBlockSize);
+
+    boost::lock_guard<boost::mutex> lock(OpenDatabasesMutex());
+    OpenDatabases().insert(this);
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
 {
+    {
+        boost::lock_guard<boost::mutex> lock(OpenDatabasesMutex());
+        OpenDatabases().erase(this);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -80,8 +174,49 @@ CLevelDBWrapper::~CLevelDBWrapper()
     options.env = NULL;
 }
 
+void CLevelDBWrapper::GetStats(CLevelDBStats& stats) const
+{
+    stats.strName = name;
+    stats.strPath = strPath;
+    stats.options = dboptions;
+    stats.nReads = nReads;
+    stats.nReadsFound = nReadsFound;
+    stats.nIterators = nIterators;
+    stats.nBatches = nBatches;
+    stats.nBytesWritten = nBytesWritten;
+
+    leveldb::Range range("", "\xff\xff\xff\xff");
+    pdb->GetApproximateSizes(&range, 1, &stats.nApproximateSize);
+
+    // leveldb.stats is a table with a row per non-empty level, after a header
+    // that ends with a line of dashes.
+    stats.vLevels.clear();
+    std::string strStats;
+    if (!pdb->GetProperty("leveldb.stats", &strStats))
+        return;
+    std::istringstream ss(strStats.substr(strStats.rfind("---") + 3));
+    std::string strLine;
+    while (std::getline(ss, strLine)) {
+        CLevelDBLevelStats level;
+        if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMB, &level.dTimeSec, &level.dReadMB, &level.dWriteMB) == 6)
+            stats.vLevels.push_back(level);
+    }
+}
+
+void GetLevelDBStats(std::vector<CLevelDBStats>& vStats)
+{
+    boost::lock_guard<boost::mutex> lock(OpenDatabasesMutex());
+    vStats.clear();
+    BOOST_FOREACH (const CLevelDBWrapper* pdb, OpenDatabases()) {
+        vStats.push_back(CLevelDBStats());
+        pdb->GetStats(vStats.back());
+    }
+}
+
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync) throw(leveldb_error)
 {
+    nBatches++;
+    nBytesWritten += batch.SizeEstimate();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     HandleError(status);
     return true;
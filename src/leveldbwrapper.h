@@ -11,6 +11,10 @@
 #include "util.h"
 #include "version.h"
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -24,6 +28,49 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+/**
+ * Tunables of one CLevelDBWrapper. The defaults follow from the cache size
+ * given to the database; -dboption=<db>.<option>=<n> overrides them, where
+ * <db> is the name of the database directory.
+ */
+struct CLevelDBOptions {
+    size_t nBlockCache;  //!< bytes of uncompressed blocks kept in memory
+    size_t nWriteBuffer; //!< bytes of changes held in memory before they are sorted to disk
+    int nBloomBits;      //!< bits per key of the bloom filters, 0 for none
+    bool fCompression;
+    int nMaxOpenFiles;
+    size_t nBlockSize; //!< bytes of user data per block
+
+    CLevelDBOptions(size_t nCacheSize = 0);
+};
+
+/** Compaction statistics of one LevelDB level, as reported in leveldb.stats */
+struct CLevelDBLevelStats {
+    int nLevel;
+    int nFiles;
+    double dSizeMB;
+    double dTimeSec;
+    double dReadMB;
+    double dWriteMB;
+};
+
+/** Statistics of an open database, see GetLevelDBStats() */
+struct CLevelDBStats {
+    std::string strName;
+    std::string strPath;
+    CLevelDBOptions options;
+    uint64_t nReads;
+    uint64_t nReadsFound;
+    uint64_t nIterators;
+    uint64_t nBatches;
+    uint64_t nBytesWritten;
+    uint64_t nApproximateSize;
+    std::vector<CLevelDBLevelStats> vLevels;
+};
+
+/** Collect the statistics of all open databases */
+void GetLevelDBStats(std::vector<CLevelDBStats>& vStats);
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -31,8 +78,11 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t size_estimate;
 
 public:
+    CLevelDBBatch() : size_estimate(0) {}
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -47,6 +97,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        size_estimate += ssKey.size() + ssValue.size();
     }
 
     template <typename K>
@@ -58,7 +109,31 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        size_estimate += ssKey.size();
+    }
+
+    //! Write a key and value that are serialized already
+    void WriteSerialized(const std::string& strKey, const CDataStream& ssValue)
+    {
+        batch.Put(strKey, leveldb::Slice(&ssValue[0], ssValue.size()));
+        size_estimate += strKey.size() + ssValue.size();
+    }
+
+    //! Erase a key that is serialized already
+    void EraseSerialized(const std::string& strKey)
+    {
+        batch.Delete(strKey);
+        size_estimate += strKey.size();
     }
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
+
+    //! Approximate number of key and value bytes queued in this batch
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CLevelDBWrapper
@@ -85,10 +160,27 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! name used for -dboption and statistics, the directory name
+    std::string name;
+    std::string strPath;
+    CLevelDBOptions dboptions;
+
+    //! usage counters, see GetStats()
+    mutable std::atomic<uint64_t> nReads;
+    mutable std::atomic<uint64_t> nReadsFound;
+    std::atomic<uint64_t> nIterators;
+    std::atomic<uint64_t> nBatches;
+    std::atomic<uint64_t> nBytesWritten;
+
+    void Open(const boost::filesystem::path& path, bool fMemory, bool fWipe);
+
 public:
     CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBOptions& optionsIn, bool fMemory = false, bool fWipe = false);
     ~CLevelDBWrapper();
 
+    void GetStats(CLevelDBStats& stats) const;
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const throw(leveldb_error)
     {
@@ -98,6 +190,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
+        nReads++;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
@@ -105,6 +198,7 @@ public:
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             HandleError(status);
         }
+        nReadsFound++;
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
@@ -131,6 +225,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
+        nReads++;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
@@ -138,6 +233,7 @@ public:
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             HandleError(status);
         }
+        nReadsFound++;
         return true;
     }
 
@@ -163,9 +259,16 @@ public:
         return WriteBatch(batch, true);
     }
 
+    //! Compact the whole key range, dropping the space of overwritten and erased records
+    void CompactFull()
+    {
+        pdb->CompactRange(NULL, NULL);
+    }
+
     // not exactly clean encapsulation, but it's easiest for now
     leveldb::Iterator* NewIterator()
     {
+        nIterators++;
         return pdb->NewIterator(iteroptions);
     }
 };
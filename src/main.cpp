@@ -46,6 +46,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -63,6 +64,8 @@ using namespace libzerocoin;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+//! Storage of the entries of mapBlockIndex
+static CBlockIndexArena blockIndexArena;
 map<uint256, uint256> mapProofOfStake;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 map<unsigned int, unsigned int> mapHashedBlocks;
@@ -78,7 +81,9 @@ bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
+unsigned int nBlockDownloadWindow = DEFAULT_BLOCK_DOWNLOAD_WINDOW;
+size_t nBlockPrefetchMemory = DEFAULT_BLOCK_PREFETCH_MEMORY * 1000000;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 60 * 60;
@@ -176,6 +181,33 @@ struct QueuedBlock {
 };
 map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+/**
+ * Blocks announced by inv that still have to be downloaded, in the order they were announced. As
+ * getblocks answers list blocks in chain order, the front of the list follows the chain tip and the
+ * first nBlockDownloadWindow entries are fetched from all suitable peers in parallel. Protected by cs_main.
+ */
+struct QueuedDownload {
+    uint256 hash;
+    set<NodeId> setAnnouncedBy; //! Peers that announced the block.
+    set<NodeId> setStalled;     //! Peers that failed to deliver it in time.
+};
+list<QueuedDownload> listBlocksToDownload;
+map<uint256, list<QueuedDownload>::iterator> mapBlocksToDownload;
+
+/**
+ * Blocks that arrived before their parent, keyed by the hash of the parent. They are validated as
+ * soon as the parent is connected. Protected by cs_main.
+ */
+struct PrefetchedBlock {
+    CBlock block;
+    NodeId nodeid;  //! Peer that sent the block.
+    int64_t nTime;  //! Time of arrival.
+    size_t nSize;   //! Serialized size of the block.
+};
+multimap<uint256, PrefetchedBlock> mapBlocksPrefetched;
+set<uint256> setBlocksPrefetched;
+size_t nPrefetchedBytes = 0;
+
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
@@ -235,6 +267,10 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Average time between two blocks delivered by this peer (in microseconds), or 0 if not measured yet.
+    int64_t nBlockInterval;
+    //! When this peer last delivered a block we asked for (in microseconds).
+    int64_t nLastBlockReceived;
 
     CNodeState()
     {
@@ -248,6 +284,8 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nBlockInterval = 0;
+        nLastBlockReceived = 0;
     }
 };
 
@@ -307,6 +345,18 @@ void FinalizeNode(NodeId nodeid)
 
     BOOST_FOREACH (const QueuedBlock& entry, state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
+    // Forget blocks that only this peer announced, unless they are on their way already
+    list<QueuedDownload>::iterator it = listBlocksToDownload.begin();
+    while (it != listBlocksToDownload.end()) {
+        it->setAnnouncedBy.erase(nodeid);
+        it->setStalled.erase(nodeid);
+        if (it->setAnnouncedBy.empty() && !mapBlocksInFlight.count(it->hash) && !setBlocksPrefetched.count(it->hash)) {
+            mapBlocksToDownload.erase(it->hash);
+            listBlocksToDownload.erase(it++);
+        } else {
+            it++;
+        }
+    }
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
@@ -319,6 +369,12 @@ void MarkBlockAsReceived(const uint256& hash)
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState* state = State(itInFlight->second.first);
+        // Track how fast the peer delivers, counting from the request or from its previous
+        // delivery, whichever is later, so that queued requests don't inflate the interval.
+        int64_t nNow = GetTimeMicros();
+        int64_t nInterval = std::max((int64_t)1, nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockReceived));
+        state->nBlockInterval = state->nBlockInterval == 0 ? nInterval : (7 * state->nBlockInterval + nInterval) / 8;
+        state->nLastBlockReceived = nNow;
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -343,6 +399,171 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+/** Number of blocks a peer may have in flight, based on how fast it delivered so far. */
+int GetBlocksInTransitLimit(const CNodeState* state)
+{
+    if (state->nBlockInterval == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = 1000000 * BLOCK_DOWNLOAD_TARGET_TIME / state->nBlockInterval;
+    return std::max(2, (int)std::min(nLimit, (int64_t)MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER));
+}
+
+// Requires cs_main.
+void QueueBlockDownload(NodeId nodeid, const uint256& hash)
+{
+    map<uint256, list<QueuedDownload>::iterator>::iterator it = mapBlocksToDownload.find(hash);
+    if (it == mapBlocksToDownload.end()) {
+        if (listBlocksToDownload.size() >= MAX_INV_SZ)
+            return;
+        QueuedDownload entry;
+        entry.hash = hash;
+        it = mapBlocksToDownload.insert(std::make_pair(hash, listBlocksToDownload.insert(listBlocksToDownload.end(), entry))).first;
+    }
+    it->second->setAnnouncedBy.insert(nodeid);
+}
+
+// Requires cs_main.
+void RemoveBlockDownload(const uint256& hash)
+{
+    map<uint256, list<QueuedDownload>::iterator>::iterator it = mapBlocksToDownload.find(hash);
+    if (it != mapBlocksToDownload.end()) {
+        listBlocksToDownload.erase(it->second);
+        mapBlocksToDownload.erase(it);
+    }
+}
+
+/**
+ * Pick blocks from the download window for a peer, up to the number its delivery rate allows.
+ * A peer gets the blocks it announced itself, and blocks below the height it reported when it
+ * connected, so that a single announcing peer does not have to serve the whole window.
+ */
+// Requires cs_main.
+void FindQueuedBlocksToDownload(CNode* pnode, vector<CInv>& vGetData)
+{
+    CNodeState* state = State(pnode->GetId());
+    assert(state != NULL);
+
+    int nLimit = GetBlocksInTransitLimit(state);
+    unsigned int nWindow = nBlockDownloadWindow;
+    if (nPrefetchedBytes >= nBlockPrefetchMemory)
+        nWindow = std::min(nWindow, (unsigned int)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    int nHeight = chainActive.Height();
+    list<QueuedDownload>::iterator it = listBlocksToDownload.begin();
+    for (unsigned int i = 0; it != listBlocksToDownload.end() && i < nWindow && state->nBlocksInFlight < nLimit;) {
+        QueuedDownload& entry = *it;
+        if (mapBlockIndex.count(entry.hash)) {
+            // Arrived by other means
+            MarkBlockAsReceived(entry.hash);
+            mapBlocksToDownload.erase(entry.hash);
+            listBlocksToDownload.erase(it++);
+            continue;
+        }
+        i++;
+        nHeight++;
+        if (entry.setStalled.size() >= entry.setAnnouncedBy.size() && !mapBlocksInFlight.count(entry.hash)) {
+            // Everybody who announced it stalled, give them another chance
+            entry.setStalled.clear();
+        }
+        if (!mapBlocksInFlight.count(entry.hash) && !setBlocksPrefetched.count(entry.hash) && !entry.setStalled.count(pnode->GetId()) &&
+            (entry.setAnnouncedBy.count(pnode->GetId()) || pnode->nStartingHeight >= nHeight)) {
+            vGetData.push_back(CInv(MSG_BLOCK, entry.hash));
+            MarkBlockAsInFlight(pnode->GetId(), entry.hash);
+            LogPrint("net", "Requesting block %s (~%d) peer=%d\n", entry.hash.ToString(), nHeight, pnode->id);
+        }
+        it++;
+    }
+}
+
+/**
+ * Give up on a block a peer is too slow to deliver, so that another peer that announced it can be
+ * asked instead. Returns false if nobody else could deliver it, in which case we keep waiting.
+ */
+// Requires cs_main.
+bool ReleaseStalledBlock(NodeId nodeid, const uint256& hash)
+{
+    map<uint256, list<QueuedDownload>::iterator>::iterator it = mapBlocksToDownload.find(hash);
+    if (it == mapBlocksToDownload.end())
+        return false;
+    QueuedDownload& entry = *it->second;
+    entry.setStalled.insert(nodeid);
+    bool fOthers = nPreferredDownload > 1;
+    BOOST_FOREACH (NodeId other, entry.setAnnouncedBy)
+        fOthers |= !entry.setStalled.count(other);
+    if (!fOthers) {
+        entry.setStalled.erase(nodeid);
+        return false;
+    }
+
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        CNodeState* state = State(nodeid);
+        nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
+        state->vBlocksInFlight.erase(itInFlight->second.second);
+        state->nBlocksInFlight--;
+        mapBlocksInFlight.erase(itInFlight);
+    }
+    return true;
+}
+
+/**
+ * Keep a block that arrived before its parent, if we asked for it and its parent is on its way.
+ * Returns false if the block was not kept.
+ */
+// Requires cs_main.
+bool PrefetchBlock(NodeId nodeid, const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    if (!mapBlocksToDownload.count(hash) || setBlocksPrefetched.count(hash))
+        return false;
+    if (!mapBlocksToDownload.count(block.hashPrevBlock) && !setBlocksPrefetched.count(block.hashPrevBlock))
+        return false;
+
+    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nPrefetchedBytes + nSize > nBlockPrefetchMemory) {
+        // Make room by dropping blocks whose parent did not show up in time
+        int64_t nExpire = GetTime() - BLOCK_PREFETCH_EXPIRY;
+        multimap<uint256, PrefetchedBlock>::iterator it = mapBlocksPrefetched.begin();
+        while (it != mapBlocksPrefetched.end()) {
+            if (it->second.nTime < nExpire) {
+                LogPrint("net", "Dropping prefetched block %s\n", it->second.block.GetHash().ToString());
+                RemoveBlockDownload(it->second.block.GetHash());
+                setBlocksPrefetched.erase(it->second.block.GetHash());
+                nPrefetchedBytes -= it->second.nSize;
+                mapBlocksPrefetched.erase(it++);
+            } else {
+                it++;
+            }
+        }
+        if (nPrefetchedBytes + nSize > nBlockPrefetchMemory)
+            return false;
+    }
+
+    MarkBlockAsReceived(hash);
+    PrefetchedBlock prefetched;
+    prefetched.block = block;
+    prefetched.nodeid = nodeid;
+    prefetched.nTime = GetTime();
+    prefetched.nSize = nSize;
+    mapBlocksPrefetched.insert(std::make_pair(block.hashPrevBlock, prefetched));
+    setBlocksPrefetched.insert(hash);
+    nPrefetchedBytes += nSize;
+    return true;
+}
+
+/** Take the prefetched blocks that build on the given block out of the buffer. */
+// Requires cs_main.
+void TakePrefetchedBlocks(const uint256& hashParent, vector<PrefetchedBlock>& vBlocks)
+{
+    pair<multimap<uint256, PrefetchedBlock>::iterator, multimap<uint256, PrefetchedBlock>::iterator> range = mapBlocksPrefetched.equal_range(hashParent);
+    for (multimap<uint256, PrefetchedBlock>::iterator it = range.first; it != range.second; it++) {
+        vBlocks.push_back(it->second);
+        setBlocksPrefetched.erase(it->second.block.GetHash());
+        nPrefetchedBytes -= it->second.nSize;
+    }
+    mapBlocksPrefetched.erase(range.first, range.second);
+}
+
 /** Check whether the last unknown block a peer advertized is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid)
 {
@@ -504,6 +725,7 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
+    nodeSignals.ProcessAsyncMessage.connect(&ProcessAsyncMessage);
     nodeSignals.SendMessages.connect(&SendMessages);
     nodeSignals.InitializeNode.connect(&InitializeNode);
     nodeSignals.FinalizeNode.connect(&FinalizeNode);
@@ -513,6 +735,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.disconnect(&GetHeight);
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
+    nodeSignals.ProcessAsyncMessage.disconnect(&ProcessAsyncMessage);
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
@@ -533,6 +756,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewBuffered* pcoinsBuffer = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
@@ -1037,11 +1261,9 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
                 return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
             }
 
-            Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-                                    newSpend.getDenomination(), bnAccumulatorValue);
-
-            //Check that the coin has been accumulated
-            if(!newSpend.Verify(accumulator))
+            //Check that the coin has been accumulated, unless this spend was verified before
+            bool fV1Params = chainActive.Height() < Params().Zerocoin_Block_V2_Start();
+            if (!VerifyZerocoinSpendCached(txin, newSpend, bnAccumulatorValue, fV1Params))
                     return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
         }
 
@@ -1063,6 +1285,16 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
 }
 
 bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+{
+    // Do not require signature verification if this is initial sync and a block over 24 hours old
+    bool fVerifySignature = false;
+    if (fZerocoinActive && tx.IsZerocoinSpend())
+        fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
+
+    return CheckTransaction(tx, fZerocoinActive, fRejectBadUTXO, fVerifySignature, true, state);
+}
+
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, bool fVerifyZerocoinSpends, bool fCheckMints, CValidationState& state)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1096,7 +1328,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
         if (!MoneyRange(nValueOut))
             return state.DoS(100, error("CheckTransaction() : txout total out of range"),
                 REJECT_INVALID, "bad-txns-txouttotal-toolarge");
-        if (fZerocoinActive && txout.IsZerocoinMint()) {
+        if (fZerocoinActive && fCheckMints && txout.IsZerocoinMint()) {
             if(!CheckZerocoinMint(tx.GetHash(), txout, state, true))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin mint"));
         }
@@ -1116,9 +1348,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
                                      error("CheckTransaction() : zerocoinspend contains inputs that are not zerocoins"));
             }
 
-            // Do not require signature verification if this is initial sync and a block over 24 hours old
-            bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            if (!CheckZerocoinSpend(tx, fVerifyZerocoinSpends, state))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1212,7 +1442,17 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+/** Drop expired transactions and trim the pool to its size limit */
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, int64_t age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+static bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1375,9 +1615,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1391,6 +1631,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // The pool's minimum fee rises while it is full
+            CAmount nModifiedFees = nFees;
+            double dPriorityDummy = 0;
+            pool.ApplyDeltas(hash, dPriorityDummy, nModifiedFees);
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nModifiedFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.IsZerocoinMint()) {
                 if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1448,7 +1698,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Trim the pool, which evicts this transaction again if its
+        // package pays the lowest fee rate
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool : mempool full, %s not kept", hash.ToString()),
+                REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1460,6 +1717,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees);
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
 {
     AssertLockHeld(cs_main);
@@ -2009,6 +2271,19 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CTxCheck::operator()()
+{
+    CValidationState state;
+    try {
+        if (nOut >= 0)
+            return CheckZerocoinMint(ptx->GetHash(), ptx->vout[nOut], state, true);
+        return CheckTransaction(*ptx, fZerocoinActive, fRejectBadUTXO, fVerifyZerocoinSpends, false, state);
+    } catch (std::exception& e) {
+        // Fail the check, CheckBlock repeats it on its own thread where the exception is handled
+        return false;
+    }
+}
+
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
 
@@ -2355,6 +2630,16 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+/** Queue for the transaction checks of CheckBlock. Only one thread at a time may use it, see cs_txcheckqueue. */
+static CCheckQueue<CTxCheck> txcheckqueue(128);
+static CCriticalSection cs_txcheckqueue;
+
+void ThreadTxCheck()
+{
+    RenameThread("qbiccoin-txcheck");
+    txcheckqueue.Thread();
+}
+
 void RecalculateZQBICMinted()
 {
     CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
@@ -2370,10 +2655,9 @@ void RecalculateZQBICMinted()
         std::list<CZerocoinMint> listMints;
         BlockToZerocoinMintList(block, listMints, true);
 
-        vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
+        pindex->nMintsInBlock.fill(0);
         for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+            pindex->AddMint(mint.GetDenomination());
 
         if (pindex->nHeight < nHeightEnd)
             pindex = chainActive.Next(pindex);
@@ -2396,17 +2680,15 @@ void RecalculateZQBICSpent()
         list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
 
         //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+        pindex->nZerocoinSupply = pindex->pprev->nZerocoinSupply;
 
         //Add mints to zQBIC supply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-        }
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            pindex->AddZerocoinSupply(denom, pindex->GetMintCount(denom));
 
         //Remove spends from zQBIC supply
         for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZerocoinSupply(denom, -1);
 
         //Rewrite money supply
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
@@ -2546,21 +2828,18 @@ bool UpdateZQBICSupply(const CBlock& block, CBlockIndex* pindex)
     std::list<libzerocoin::CoinDenomination> listSpends = ZerocoinSpendListFromBlock(block, fFilterInvalid);
 
     // Initialize zerocoin supply to the supply from previous block
-    if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3) {
-        for (auto& denom : zerocoinDenomList) {
-            pindex->mapZerocoinSupply.at(denom) = pindex->pprev->mapZerocoinSupply.at(denom);
-        }
-    }
+    if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3)
+        pindex->nZerocoinSupply = pindex->pprev->nZerocoinSupply;
 
     // Track zerocoin money supply
     CAmount nAmountZerocoinSpent = 0;
-    pindex->vMintDenominationsInBlock.clear();
+    pindex->nMintsInBlock.fill(0);
     if (pindex->pprev) {
         std::set<uint256> setAddedToWallet;
         for (auto& m : listMints) {
             libzerocoin::CoinDenomination denom = m.GetDenomination();
-            pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-            pindex->mapZerocoinSupply.at(denom)++;
+            pindex->AddMint(denom);
+            pindex->AddZerocoinSupply(denom, 1);
 
             //Remove any of our own mints from the mintpool
             if (pwalletMain) {
@@ -2585,17 +2864,17 @@ bool UpdateZQBICSupply(const CBlock& block, CBlockIndex* pindex)
         }
 
         for (auto& denom : listSpends) {
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZerocoinSupply(denom, -1);
             nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
             // zerocoin failsafe
-            if (pindex->mapZerocoinSupply.at(denom) < 0)
+            if (pindex->GetZerocoinSupply(denom) < 0)
                 return error("Block contains zerocoins that spend more than are in the available supply to spend");
         }
     }
 
     for (auto& denom : zerocoinDenomList)
-        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
+        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->GetZerocoinSupply(denom));
 
     return true;
 }
@@ -2940,19 +3219,126 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+/** Everything a chain state flush writes, copied out while holding cs_main */
+struct CChainStateFlush {
+    std::vector<std::pair<int, CBlockFileInfo> > vFileInfo;
+    int nLastFile;
+    std::vector<CDiskBlockIndex> vBlockIndex;
+    bool fSetBestChain;
+    CBlockLocator locator;
+
+    CChainStateFlush() : nLastFile(0), fSetBestChain(false) {}
+};
+
+/** Hand-off between FlushStateToDisk and ThreadFlushChainState */
+static boost::mutex csChainStateFlush;
+static boost::condition_variable cvChainStateFlush;
+static boost::shared_ptr<CChainStateFlush> pendingChainStateFlush; // queued or being written
+static bool fChainStateFlushThread = false;
+static bool fChainStateFlushFailed = false;
+static CChainStateFlushStats chainStateFlushStats;
+
+/** Write a flush to disk: block files, then the block index, then the coins (which refer to both). */
+static bool WriteChainState(const CChainStateFlush& flush)
+{
+    int64_t nStart = GetTimeMicros();
+    try {
+        FlushBlockFile();
+        if (!pblocktree->WriteBatchSync(flush.vFileInfo, flush.nLastFile, flush.vBlockIndex))
+            return error("%s : failed to write to block index", __func__);
+        if (!pcoinsBuffer->Write())
+            return error("%s : failed to write to coin database", __func__);
+    } catch (const std::runtime_error& e) {
+        return error("%s : %s", __func__, e.what());
+    }
+    // Update best block in wallet (so we can detect restored wallets).
+    if (flush.fSetBestChain)
+        GetMainSignals().SetBestChain(flush.locator);
+
+    int64_t nTime = GetTimeMicros() - nStart;
+    LogPrint("bench", "- Chain state write: %.2fms (%u index entries)\n", nTime * 0.001, flush.vBlockIndex.size());
+    boost::unique_lock<boost::mutex> lock(csChainStateFlush);
+    chainStateFlushStats.nFlushes++;
+    chainStateFlushStats.nLastWrite = nTime;
+    chainStateFlushStats.nMaxWrite = std::max(chainStateFlushStats.nMaxWrite, nTime);
+    chainStateFlushStats.nTotalWrite += nTime;
+    return true;
+}
+
+/** Wait until the previous flush has been written. Returns false if writing it failed. */
+static bool WaitForChainStateFlush()
+{
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(csChainStateFlush);
+    while (pendingChainStateFlush)
+        cvChainStateFlush.wait(lock);
+    return !fChainStateFlushFailed;
+}
+
+void ThreadFlushChainState()
+{
+    RenameThread("qbiccoin-flush");
+    boost::unique_lock<boost::mutex> lock(csChainStateFlush);
+    fChainStateFlushThread = true;
+    try {
+        while (true) {
+            while (!pendingChainStateFlush)
+                cvChainStateFlush.wait(lock);
+            boost::shared_ptr<CChainStateFlush> flush = pendingChainStateFlush;
+            lock.unlock();
+            bool fOk = WriteChainState(*flush);
+            if (!fOk)
+                AbortNode("Failed to write chain state");
+            lock.lock();
+            fChainStateFlushFailed |= !fOk;
+            pendingChainStateFlush.reset();
+            cvChainStateFlush.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Write whatever was queued before the interruption, so that nobody
+        // waits for it in vain and the final flush on shutdown finds the
+        // buffer empty.
+        if (!lock.owns_lock())
+            lock.lock();
+        fChainStateFlushThread = false;
+        boost::shared_ptr<CChainStateFlush> flush = pendingChainStateFlush;
+        if (flush) {
+            lock.unlock();
+            bool fOk = WriteChainState(*flush);
+            lock.lock();
+            fChainStateFlushFailed |= !fOk;
+            pendingChainStateFlush.reset();
+            cvChainStateFlush.notify_all();
+        }
+        throw;
+    }
+}
+
+void GetChainStateFlushStats(CChainStateFlushStats& stats)
+{
+    boost::unique_lock<boost::mutex> lock(csChainStateFlush);
+    stats = chainStateFlushStats;
+    stats.fPending = (bool)pendingChainStateFlush;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
  * fast is not set and it's been a while since the last write.
+ * Only copying the dirty state out happens under cs_main; the disk writes are
+ * left to ThreadFlushChainState, unless mode is FLUSH_STATE_ALWAYS (which
+ * returns once everything is on disk) or that thread is not running.
  */
 bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
+        size_t cacheUsage = pcoinsTip->DynamicMemoryUsage();
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && cacheUsage > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+            int64_t nStart = GetTimeMicros();
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
@@ -2960,35 +3346,43 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
-            // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
-            // Then update all block file information (which may refer to block and undo files).
-            bool fileschanged = false;
-            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end();) {
-                if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                    return state.Abort("Failed to write to block index");
-                }
-                fileschanged = true;
-                setDirtyFileInfo.erase(it++);
-            }
-            if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-                return state.Abort("Failed to write to block index");
-            }
-            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();) {
-                if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                    return state.Abort("Failed to write to block index");
-                }
-                setDirtyBlockIndex.erase(it++);
-            }
-            pblocktree->Sync();
-            // Finally flush the chainstate (which may refer to block index entries).
+            LogPrint("coindb", "Flushing coins cache: %u entries, %.1fMiB (budget %.1fMiB)\n",
+                pcoinsTip->GetCacheSize(), cacheUsage * (1.0 / (1 << 20)), nCoinCacheUsage * (1.0 / (1 << 20)));
+            // The buffer below pcoinsTip has to be empty again before it can take the next batch.
+            if (!WaitForChainStateFlush())
+                return state.Abort("Failed to write chain state");
+            boost::shared_ptr<CChainStateFlush> flush(new CChainStateFlush());
+            // Copy the block file information and block index entries, which
+            // keep changing while they are written.
+            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); it++)
+                flush->vFileInfo.push_back(std::make_pair(*it, vinfoBlockFile[*it]));
+            setDirtyFileInfo.clear();
+            flush->nLastFile = nLastBlockFile;
+            flush->vBlockIndex.reserve(setDirtyBlockIndex.size());
+            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); it++)
+                flush->vBlockIndex.push_back(CDiskBlockIndex(*it));
+            setDirtyBlockIndex.clear();
+            // Move the dirty coins into the buffer, leaving pcoinsTip empty.
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
-            // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
-                GetMainSignals().SetBestChain(chainActive.GetLocator());
+                flush->fSetBestChain = true;
+                flush->locator = chainActive.GetLocator();
             }
             nLastWrite = GetTimeMicros();
+
+            boost::unique_lock<boost::mutex> lock(csChainStateFlush);
+            if (mode == FLUSH_STATE_ALWAYS || !fChainStateFlushThread) {
+                lock.unlock();
+                if (!WriteChainState(*flush))
+                    return state.Abort("Failed to write chain state");
+                lock.lock();
+            } else {
+                pendingChainStateFlush = flush;
+                cvChainStateFlush.notify_all();
+            }
+            chainStateFlushStats.nLastStall = GetTimeMicros() - nStart;
+            LogPrint("bench", "- Chain state flush: %.2fms holding cs_main\n", chainStateFlushStats.nLastStall * 0.001);
         }
     } catch (const std::runtime_error& e) {
         return state.Abort(std::string("System error while flushing: ") + e.what());
@@ -3015,10 +3409,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -3106,6 +3500,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
 
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
+    uint64_t nSpendDecodes = GetZerocoinSpendDecodeCount();
     CBlock block;
     if (!pblock) {
         if (!ReadBlockFromDisk(block, pindexNew))
@@ -3148,7 +3543,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
 
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
-    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted);
+    mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
@@ -3167,6 +3562,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    LogPrint("bench", "- Zerocoin spend decodes: %u\n", (unsigned)(GetZerocoinSpendDecodeCount() - nSpendDecodes));
     return true;
 }
 
@@ -3545,8 +3941,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Create(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3894,9 +4289,42 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // Check transactions
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
+    bool fRejectBadUTXO = chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange();
+    // Do not require signature verification if this is initial sync and a block over 24 hours old
+    bool fVerifyZerocoinSpends = false;
+    if (fZerocoinActive) {
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.IsZerocoinSpend()) {
+                fVerifyZerocoinSpends = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
+                break;
+            }
+        }
+    }
+
+    // Run the transaction checks and the zerocoin mint validations (primality tests) on the check
+    // queue threads. The checks on the queue can't report why they failed, so a block failing them
+    // goes through the serial checks below to fill in the validation state.
+    bool fTxChecked = false;
+    if (nScriptCheckThreads && block.vtx.size() > 1) {
+        TRY_LOCK(cs_txcheckqueue, lockQueue);
+        if (lockQueue) {
+            CCheckQueueControl<CTxCheck> control(&txcheckqueue);
+            vector<CTxCheck> vChecks;
+            for (const CTransaction& tx : block.vtx) {
+                vChecks.push_back(CTxCheck(tx, -1, fZerocoinActive, fRejectBadUTXO, fVerifyZerocoinSpends));
+                for (unsigned int i = 0; fZerocoinActive && i < tx.vout.size(); i++) {
+                    if (tx.vout[i].IsZerocoinMint())
+                        vChecks.push_back(CTxCheck(tx, i, fZerocoinActive, fRejectBadUTXO, fVerifyZerocoinSpends));
+                }
+            }
+            control.Add(vChecks);
+            fTxChecked = control.Wait();
+        }
+    }
+
     vector<CBigNum> vBlockSerials;
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+        if (!fTxChecked && !CheckTransaction(tx, fZerocoinActive, fRejectBadUTXO, fVerifyZerocoinSpends, true, state))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zQBIC spends in this block
@@ -4323,6 +4751,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         LOCK(cs_main);   // Replaces the former TRY_LOCK loop because busy waiting wastes too much resources
 
         MarkBlockAsReceived (pblock->GetHash ());
+        RemoveBlockDownload (pblock->GetHash ());
         if (!checked) {
             return error ("%s : CheckBlock FAILED for block %s", __func__, pblock->GetHash().GetHex());
         }
@@ -4461,9 +4890,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Create();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     //mark as PoS seen
@@ -4477,8 +4904,11 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB(string& strError)
 {
-    if (!pblocktree->LoadBlockIndexGuts())
+    int64_t nStart = GetTimeMillis();
+    if (!pblocktree->LoadBlockIndexGuts(pcoinsTip->GetBestBlock(), GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT)))
         return false;
+    LogPrint("bench", "%s: loaded %u block index entries of %u bytes in %dms\n", __func__,
+        mapBlockIndex.size(), sizeof(CBlockIndex), GetTimeMillis() - nStart);
 
     boost::this_thread::interruption_point();
 
@@ -4631,7 +5061,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4825,6 +5255,124 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
     return nLoaded > 0;
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/**
+ * mempool.dat holds the fee deltas and zQBIC spend times up front, followed
+ * by a count and one (transaction, entry time) record per transaction, so it
+ * can be read back one transaction at a time.
+ */
+bool DumpMempool()
+{
+    static boost::mutex csDumpMempool;
+    boost::lock_guard<boost::mutex> lockDump(csDumpMempool);
+
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, int64_t> mapSpendTimes;
+    {
+        LOCK(cs_main);
+        mapSpendTimes = mapZerocoinspends;
+    }
+
+    // Serialize in memory so the pool is not locked while writing to disk
+    CDataStream ssMempool(SER_DISK, CLIENT_VERSION);
+    uint64_t nCount = 0;
+    {
+        LOCK(mempool.cs);
+        nCount = mempool.mapTx.size();
+        ssMempool << MEMPOOL_DUMP_VERSION;
+        ssMempool << mempool.mapDeltas;
+        ssMempool << mapSpendTimes;
+        ssMempool << nCount;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx)
+            ssMempool << e.GetTx() << e.GetTime();
+    }
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s : failed to open %s", __func__, pathTmp.string());
+        fileout.write(&ssMempool[0], ssMempool.size());
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s : failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s : failed to write mempool: %s", __func__, e.what());
+    }
+    int64_t nEnd = GetTimeMicros();
+
+    LogPrintf("Dumped %u mempool transactions (%u bytes): %.2fms to serialize, %.2fms to write\n",
+        nCount, ssMempool.size(), (nMid - nStart) * 0.001, (nEnd - nMid) * 0.001);
+    return true;
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    CAutoFile filein(fopen(pathMempool.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("%s : no mempool.dat, starting with an empty mempool\n", __func__);
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    int nLoaded = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s : unknown mempool.dat version %u", __func__, nVersion);
+
+        // Apply the deltas first so they count towards the fee checks below
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        std::map<uint256, int64_t> mapSpendTimes;
+        filein >> mapSpendTimes;
+
+        uint64_t nCount;
+        filein >> nCount;
+        while (nCount--) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx >> nTime;
+
+            if (nTime + nExpiryTimeout <= nNow) {
+                nExpired++;
+                continue;
+            }
+
+            LOCK(cs_main);
+            CValidationState state;
+            if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime, false, false)) {
+                nLoaded++;
+                std::map<uint256, int64_t>::const_iterator it = mapSpendTimes.find(tx.GetHash());
+                if (it != mapSpendTimes.end())
+                    mapZerocoinspends[it->first] = it->second;
+            } else {
+                nFailed++;
+            }
+
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        return error("%s : failed to deserialize mempool.dat: %s", __func__, e.what());
+    }
+
+    LogPrintf("Loaded %i mempool transactions from disk (%i failed, %i expired) in %.2fms\n",
+        nLoaded, nFailed, nExpired, (GetTimeMicros() - nStart) * 0.001);
+    return true;
+}
+
 void static CheckBlockIndex()
 {
     if (!fCheckBlockIndex) {
@@ -5189,7 +5737,8 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
                     if (mapTxLockVote.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        // Signed masternode messages serialize differently for older peers
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << mapTxLockVote[inv.hash];
                         pfrom->PushMessage("txlvote", ss);
@@ -5216,7 +5765,7 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
                     if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
                         pfrom->PushMessage("mnw", ss);
@@ -5225,7 +5774,7 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (!pushed && inv.type == MSG_BUDGET_VOTE) {
                     if (budget.mapSeenMasternodeBudgetVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << budget.mapSeenMasternodeBudgetVotes[inv.hash];
                         pfrom->PushMessage("mvote", ss);
@@ -5245,7 +5794,7 @@ void static ProcessGetData(CNode* pfrom)
 
                 if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
                     if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
                         pfrom->PushMessage("fbvote", ss);
@@ -5265,7 +5814,7 @@ void static ProcessGetData(CNode* pfrom)
 
                 if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
                     if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
                         pfrom->PushMessage("mnb", ss);
@@ -5275,7 +5824,7 @@ void static ProcessGetData(CNode* pfrom)
 
                 if (!pushed && inv.type == MSG_MASTERNODE_PING) {
                     if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        CDataStream ss(SER_NETWORK, min(pfrom->nVersion, PROTOCOL_VERSION));
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenMasternodePing[inv.hash];
                         pfrom->PushMessage("mnp", ss);
@@ -5322,7 +5871,91 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Validate the blocks that were downloaded ahead of the given block, and in turn their own
+ * prefetched descendants. Blocks building on a block that was rejected are dropped.
+ */
+void static ProcessPrefetchedBlocks(const uint256& hashParent)
+{
+    std::deque<uint256> queue(1, hashParent);
+    while (!queue.empty()) {
+        vector<PrefetchedBlock> vBlocks;
+        bool fParentKnown;
+        {
+            LOCK(cs_main);
+            fParentKnown = mapBlockIndex.count(queue.front()) && !(mapBlockIndex[queue.front()]->nStatus & BLOCK_FAILED_MASK);
+            TakePrefetchedBlocks(queue.front(), vBlocks);
+        }
+        queue.pop_front();
+
+        BOOST_FOREACH (PrefetchedBlock& prefetched, vBlocks) {
+            uint256 hash = prefetched.block.GetHash();
+            queue.push_back(hash);
+            if (!fParentKnown) {
+                LOCK(cs_main);
+                RemoveBlockDownload(hash);
+                continue;
+            }
+
+            CValidationState state;
+            ProcessNewBlock(state, NULL, &prefetched.block);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                Misbehaving(prefetched.nodeid, nDoS);
+            }
+        }
+    }
+}
+
 bool fRequestedSporksIDB = false;
+/**
+ * Masternode, budget, payment and SwiftX messages. Their handlers verify signatures
+ * under their own locks and only take cs_main briefly, so they are processed on the
+ * asynchronous message handler threads instead of queueing behind block and inventory
+ * processing.
+ */
+static bool IsAsyncMessage(const string& strCommand)
+{
+    static const char* const pszAsyncCommands[] = {
+        "mnb", "mnp", "dseg", "mnget", "mnw", "ssc",
+        "mnvs", "mprop", "mvote", "fbs", "fbvote",
+        "ix", "txlvote"};
+    for (unsigned int i = 0; i < ARRAYLEN(pszAsyncCommands); i++) {
+        if (strCommand == pszAsyncCommands[i])
+            return true;
+    }
+    return false;
+}
+
+void static ProcessMessageExtensions(CNode* pfrom, string& strCommand, CDataStream& vRecv)
+{
+    obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
+    mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+    budget.ProcessMessage(pfrom, strCommand, vRecv);
+    masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+    ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
+    ProcessSpork(pfrom, strCommand, vRecv);
+    masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+    GetMainSignals().ProcessedMasternodeMessage(strCommand);
+}
+
+void ProcessAsyncMessage(CNode* pfrom, string& strCommand, CDataStream& vRecv)
+{
+    try {
+        ProcessMessageExtensions(pfrom, strCommand, vRecv);
+    } catch (std::ios_base::failure& e) {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+        LogPrintf("ProcessAsyncMessage(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), vRecv.size(), e.what());
+    } catch (boost::thread_interrupted) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessAsyncMessage()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessAsyncMessage()");
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -5546,6 +6179,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LOCK(cs_main);
 
         std::vector<CInv> vToFetch;
+        bool fQueuedBlocks = false;
 
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++) {
             const CInv& inv = vInv[nInv];
@@ -5562,9 +6196,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
+                if (!fAlreadyHave && !fImporting && !fReindex) {
+                    // Add this to the blocks to download, the scheduler picks who to request it from
+                    QueueBlockDownload(pfrom->GetId(), inv.hash);
+                    fQueuedBlocks = true;
                     LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                 }
             }
@@ -5578,6 +6213,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
+        // Request what we can from the announcing peer right away, without waiting for SendMessages
+        if (fQueuedBlocks)
+            FindQueuedBlocksToDownload(pfrom, vToFetch);
         if (!vToFetch.empty())
             pfrom->PushMessage("getdata", vToFetch);
     }
@@ -5900,14 +6538,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
-                //we already asked for this block, so lets work backwards and ask for the previous block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
-                pfrom->vBlockRequested.push_back(block.hashPrevBlock);
+            LOCK(cs_main);
+            if (PrefetchBlock(pfrom->GetId(), block)) {
+                // we asked for it ahead of its parent, it is validated once the parent arrives
+                LogPrint("net", "prefetched block %s waiting for %s peer=%d\n", hashBlock.ToString(), block.hashPrevBlock.ToString(), pfrom->id);
             } else {
-                //ask to sync to this block
-                pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
-                pfrom->vBlockRequested.push_back(hashBlock);
+                // the getblocks answer announces it again
+                MarkBlockAsReceived(hashBlock);
+                RemoveBlockDownload(hashBlock);
+                if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+                    //we already asked for this block, so lets work backwards and ask for the previous block
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
+                    pfrom->vBlockRequested.push_back(block.hashPrevBlock);
+                } else {
+                    //ask to sync to this block
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
+                    pfrom->vBlockRequested.push_back(hashBlock);
+                }
             }
         } else {
             pfrom->AddInventoryKnown(inv);
@@ -5924,10 +6571,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
                     }
                 }
+                ProcessPrefetchedBlocks(hashBlock);
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
             } else {
                 LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                LOCK(cs_main);
+                MarkBlockAsReceived(hashBlock);
+                RemoveBlockDownload(hashBlock);
             }
         }
     }
@@ -6151,15 +6802,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 LogPrint("net", "Unparseable reject message received\n");
             }
         }
+    } else if (IsAsyncMessage(strCommand) && QueueAsyncMessage(pfrom, strCommand, vRecv)) {
+        // handed off to the asynchronous message handler threads, see ProcessAsyncMessage
     } else {
         //probably one the extensions
-        obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
-        mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
-        budget.ProcessMessage(pfrom, strCommand, vRecv);
-        masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
-        ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
-        ProcessSpork(pfrom, strCommand, vRecv);
-        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        ProcessMessageExtensions(pfrom, strCommand, vRecv);
     }
 
 
@@ -6205,6 +6852,10 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // Check the signatures of queued masternode messages together on the
+    // signature check threads; the handlers below still run one at a time, in order
+    CheckMasternodeMessageSignatures(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -6246,7 +6897,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        const uint256& hash = msg.GetMessageHash();
         unsigned int nChecksum = 0;
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
         if (nChecksum != hdr.nChecksum) {
@@ -6286,8 +6937,11 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itRecycle = pfrom->vRecvMsg.begin(); itRecycle != it; ++itRecycle)
+            pfrom->RecycleRecvMsg(*itRecycle);
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
@@ -6474,6 +7128,16 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
             pto->fDisconnect = true;
         }
+        // Hand announced blocks over to other peers when this one delivered nothing for several times
+        // its usual block interval. It is asked for less from now on.
+        if (!pto->fDisconnect && state.vBlocksInFlight.size() > 0) {
+            const QueuedBlock& queued = state.vBlocksInFlight.front();
+            int64_t nStallTimeout = std::max((int64_t)1000000 * BLOCK_STALLING_TIMEOUT, 4 * state.nBlockInterval);
+            if (std::max(queued.nTime, state.nLastBlockReceived) < nNow - nStallTimeout && ReleaseStalledBlock(pto->GetId(), queued.hash)) {
+                LogPrint("net", "Peer=%d is stalling download of block %s, asking other peers\n", pto->id, queued.hash.ToString());
+                state.nBlockInterval = nStallTimeout;
+            }
+        }
 
         //
         // Message: getdata (blocks)
@@ -6496,6 +7160,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 }
             }
         }
+        if (!pto->fDisconnect && !pto->fClient && fFetch && !fImporting && !fReindex)
+            FindQueuedBlocksToDownload(pto, vGetData);
 
         //
         // Message: getdata (non-blocks)
@@ -6586,10 +7252,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
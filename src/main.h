@@ -77,6 +77,14 @@ static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 5;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, save the mempool on shutdown and load it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Interval in seconds between periodic writes of mempool.dat */
+static const int64_t MEMPOOL_DUMP_INTERVAL = 15 * 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -103,6 +111,16 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** -blockdownloadwindow default: number of announced blocks that may be downloaded ahead of the chain tip */
+static const unsigned int DEFAULT_BLOCK_DOWNLOAD_WINDOW = 256;
+/** -blockprefetchmem default: memory in MB for blocks that arrived before their parent */
+static const unsigned int DEFAULT_BLOCK_PREFETCH_MEMORY = 32;
+/** Number of blocks a fast peer may be asked for at once. Slower peers get less, see BLOCK_DOWNLOAD_TARGET_TIME. */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER = 64;
+/** Time in seconds worth of deliveries, at its measured rate, that a peer is asked for at once. */
+static const unsigned int BLOCK_DOWNLOAD_TARGET_TIME = 2;
+/** Time in seconds a block that arrived before its parent is kept waiting for it when memory is short. */
+static const unsigned int BLOCK_PREFETCH_EXPIRY = 5 * 60;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -142,7 +160,9 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
+extern unsigned int nBlockDownloadWindow;
+extern size_t nBlockPrefetchMemory;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fVerifyingBlocks;
@@ -212,6 +232,8 @@ void UnloadBlockIndex();
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
+/** Process a masternode, budget or SwiftX message on an asynchronous message handler thread */
+void ProcessAsyncMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -221,6 +243,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread checking block transactions for CheckBlock */
+void ThreadTxCheck();
+/** Run the thread writing flushed chain state to disk */
+void ThreadFlushChainState();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -254,6 +280,16 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Timings of chain state flushes, in microseconds */
+struct CChainStateFlushStats {
+    uint64_t nFlushes;
+    bool fPending;
+    int64_t nLastStall; // time cs_main was held to hand off the last flush
+    int64_t nLastWrite; // time the last flush took to reach the disk
+    int64_t nMaxWrite;
+    int64_t nTotalWrite;
+};
+void GetChainStateFlushStats(CChainStateFlushStats& stats);
 
 
 /** (try to) add transaction to memory pool **/
@@ -261,6 +297,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
+/** Write the mempool, its fee deltas and zQBIC spend times to mempool.dat */
+bool DumpMempool();
+
+/** Resubmit the transactions in mempool.dat through AcceptToMemoryPool */
+bool LoadMempool();
+
 int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 bool GetCoinAge(const CTransaction& tx, unsigned int nTxTime, uint64_t& nCoinAge);
@@ -353,6 +395,8 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
 
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+/** CheckTransaction without looking at the chain state. Zerocoin mints are only validated when fCheckMints is set. */
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, bool fVerifyZerocoinSpends, bool fCheckMints, CValidationState& state);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
 bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex);
@@ -435,6 +479,37 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the context-free checks of one transaction in a block,
+ * or the validation of one of its zerocoin mints if nOut is not -1
+ * Note that this stores a reference to the transaction
+ */
+class CTxCheck
+{
+private:
+    const CTransaction* ptx;
+    int nOut;
+    bool fZerocoinActive;
+    bool fRejectBadUTXO;
+    bool fVerifyZerocoinSpends;
+
+public:
+    CTxCheck() : ptx(0), nOut(-1), fZerocoinActive(false), fRejectBadUTXO(false), fVerifyZerocoinSpends(false) {}
+    CTxCheck(const CTransaction& txIn, int nOutIn, bool fZerocoinActiveIn, bool fRejectBadUTXOIn, bool fVerifyZerocoinSpendsIn) : ptx(&txIn), nOut(nOutIn), fZerocoinActive(fZerocoinActiveIn),
+                                                                                                                                 fRejectBadUTXO(fRejectBadUTXOIn), fVerifyZerocoinSpends(fVerifyZerocoinSpendsIn) {}
+
+    bool operator()();
+
+    void swap(CTxCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(nOut, check.nOut);
+        std::swap(fZerocoinActive, check.fZerocoinActive);
+        std::swap(fRejectBadUTXO, check.fRejectBadUTXO);
+        std::swap(fVerifyZerocoinSpends, check.fVerifyZerocoinSpends);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -628,6 +703,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Holds the last flushed coins until they are on disk, below pcoinsTip */
+extern CCoinsViewBuffered* pcoinsBuffer;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
@@ -11,6 +11,7 @@
 #include "masternode-budget.h"
 #include "masternode-sync.h"
 #include "masternode.h"
+#include "masternodedb.h"
 #include "masternodeman.h"
 #include "obfuscation.h"
 #include "util.h"
@@ -284,39 +285,6 @@ CBudgetDB::CBudgetDB()
     strMagicMessage = "MasternodeBudget";
 }
 
-bool CBudgetDB::Write(const CBudgetManager& objToSave)
-{
-    LOCK(objToSave.cs);
-
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
-
-    LogPrint("mnbudget","Written info to budget.dat  %dms\n", GetTimeMillis() - nStart);
-
-    return true;
-}
-
 CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
 {
     LOCK(objToLoad.cs);
@@ -404,29 +372,45 @@ CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
 
 void DumpBudgets()
 {
+    if (pMasternodeStateDB == NULL)
+        return;
+
     int64_t nStart = GetTimeMillis();
+    if (!budget.WriteState(*pMasternodeStateDB))
+        LogPrintf("Error writing budget state\n");
 
-    CBudgetDB budgetdb;
-    CBudgetManager tempBudget;
-
-    LogPrint("mnbudget","Verifying budget.dat format...\n");
-    CBudgetDB::ReadResult readResult = budgetdb.Read(tempBudget, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CBudgetDB::FileError)
-        LogPrint("mnbudget","Missing budgets file - budget.dat, will try to recreate\n");
-    else if (readResult != CBudgetDB::Ok) {
-        LogPrint("mnbudget","Error reading budget.dat: ");
-        if (readResult == CBudgetDB::IncorrectFormat)
-            LogPrint("mnbudget","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("mnbudget","file format is unknown or invalid, please fix it manually\n");
-            return;
+    LogPrint("mnbudget","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+}
+
+void LoadBudgets(bool fImportCacheFile)
+{
+    if (fImportCacheFile) {
+        CBudgetDB budgetdb;
+        CBudgetDB::ReadResult readResult = budgetdb.Read(budget);
+        if (readResult == CBudgetDB::FileError)
+            LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
+        else if (readResult != CBudgetDB::Ok) {
+            LogPrintf("Error reading budget.dat: ");
+            if (readResult == CBudgetDB::IncorrectFormat)
+                LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+            else
+                LogPrintf("file format is unknown or invalid, please fix it manually\n");
         }
+        return;
     }
-    LogPrint("mnbudget","Writting info to budget.dat...\n");
-    budgetdb.Write(budget);
 
-    LogPrint("mnbudget","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+    int64_t nStart = GetTimeMillis();
+    if (!budget.ReadState(*pMasternodeStateDB)) {
+        LogPrintf("Error reading budget state, will try to recreate\n");
+        return;
+    }
+
+    LogPrint("mnbudget","Loaded budget state  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("mnbudget","  %s\n", budget.ToString());
+    LogPrint("mnbudget","Budget manager - cleaning....\n");
+    budget.CheckAndRemove();
+    LogPrint("mnbudget","Budget manager - result:\n");
+    LogPrint("mnbudget","  %s\n", budget.ToString());
 }
 
 bool CBudgetManager::AddFinalizedBudget(CFinalizedBudget& finalizedBudget)
@@ -1150,7 +1134,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 
         mapSeenMasternodeBudgetVotes.insert(make_pair(vote.GetHash(), vote));
-        if (!vote.SignatureValid(true)) {
+        if (!vote.UpdateValid(true, mnodeman.GetListVersion())) {
             if (masternodeSync.IsSynced()) {
                 LogPrintf("CBudgetManager::ProcessMessage() : mvote - signature invalid\n");
                 Misbehaving(pfrom->GetId(), 20);
@@ -1224,7 +1208,7 @@ void CBudgetManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         mapSeenFinalizedBudgetVotes.insert(make_pair(vote.GetHash(), vote));
-        if (!vote.SignatureValid(true)) {
+        if (!vote.UpdateValid(true, mnodeman.GetListVersion())) {
             if (masternodeSync.IsSynced()) {
                 LogPrintf("CBudgetManager::ProcessMessage() : fbvote - signature invalid\n");
                 Misbehaving(pfrom->GetId(), 20);
@@ -1458,6 +1442,7 @@ CBudgetProposal::CBudgetProposal()
     nAmount = 0;
     nTime = 0;
     fValid = true;
+    Tally();
 }
 
 CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strURLIn, int nBlockStartIn, int nBlockEndIn, CScript addressIn, CAmount nAmountIn, uint256 nFeeTXHashIn)
@@ -1470,6 +1455,7 @@ CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strU
     nAmount = nAmountIn;
     nFeeTXHash = nFeeTXHashIn;
     fValid = true;
+    Tally();
 }
 
 CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
@@ -1484,6 +1470,7 @@ CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
     nFeeTXHash = other.nFeeTXHash;
     mapVotes = other.mapVotes;
     fValid = true;
+    Tally();
 }
 
 bool CBudgetProposal::IsValid(std::string& strError, bool fCheckCollateral)
@@ -1590,35 +1577,57 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
         return false;
     }
 
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.find(hash);
+    if (it != mapVotes.end())
+        CountVote((*it).second, -1);
     mapVotes[hash] = vote;
+    CountVote(vote, 1);
     LogPrint("mnbudget", "CBudgetProposal::AddOrUpdateVote - %s %s\n", strAction.c_str(), vote.GetHash().ToString().c_str());
 
     return true;
 }
 
-// If masternode voted for a proposal, but is now invalid -- remove the vote
-void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
+void CBudgetProposal::CountVote(const CBudgetVote& vote, int nDelta)
 {
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
+    if (vote.nVote < VOTE_ABSTAIN || vote.nVote > VOTE_NO) return;
+
+    nVotes[vote.nVote] += nDelta;
+    if (vote.fValid) nValidVotes[vote.nVote] += nDelta;
+}
 
+void CBudgetProposal::Tally()
+{
+    for (int i = VOTE_ABSTAIN; i <= VOTE_NO; i++) {
+        nVotes[i] = 0;
+        nValidVotes[i] = 0;
+    }
+
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
     while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
+        CountVote((*it).second, 1);
         ++it;
     }
 }
 
-double CBudgetProposal::GetRatio()
+// If masternode voted for a proposal, but is now invalid -- remove the vote
+void CBudgetProposal::CleanAndRemove(bool fSignatureCheck)
 {
-    int yeas = 0;
-    int nays = 0;
-
+    int nListVersion = mnodeman.GetListVersion();
     std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
 
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES) yeas++;
-        if ((*it).second.nVote == VOTE_NO) nays++;
+        CBudgetVote& vote = (*it).second;
+        bool fWasValid = vote.fValid;
+        if (vote.UpdateValid(fSignatureCheck, nListVersion) != fWasValid && vote.nVote >= VOTE_ABSTAIN && vote.nVote <= VOTE_NO)
+            nValidVotes[vote.nVote] += vote.fValid ? 1 : -1;
         ++it;
     }
+}
+
+double CBudgetProposal::GetRatio()
+{
+    int yeas = nVotes[VOTE_YES];
+    int nays = nVotes[VOTE_NO];
 
     if (yeas + nays == 0) return 0.0f;
 
@@ -1627,41 +1636,17 @@ double CBudgetProposal::GetRatio()
 
 int CBudgetProposal::GetYeas()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nValidVotes[VOTE_YES];
 }
 
 int CBudgetProposal::GetNays()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_NO && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nValidVotes[VOTE_NO];
 }
 
 int CBudgetProposal::GetAbstains()
 {
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_ABSTAIN && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return nValidVotes[VOTE_ABSTAIN];
 }
 
 int CBudgetProposal::GetBlockStartCycle()
@@ -1743,6 +1728,9 @@ CBudgetVote::CBudgetVote()
     nTime = 0;
     fValid = true;
     fSynced = false;
+    nCheckedListVersion = -1;
+    fCheckedSignature = false;
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 CBudgetVote::CBudgetVote(CTxIn vinIn, uint256 nProposalHashIn, int nVoteIn)
@@ -1753,6 +1741,9 @@ CBudgetVote::CBudgetVote(CTxIn vinIn, uint256 nProposalHashIn, int nVoteIn)
     nTime = GetAdjustedTime();
     fValid = true;
     fSynced = false;
+    nCheckedListVersion = -1;
+    fCheckedSignature = false;
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 void CBudgetVote::Relay()
@@ -1768,25 +1759,52 @@ bool CBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
-        LogPrint("mnbudget","CBudgetVote::Sign - Error upon calling SignMessage");
+    if (!obfuScationSigner.SignHash(GetSignatureHash(), errorMessage, vchSig, keyMasternode)) {
+        LogPrint("mnbudget","CBudgetVote::Sign - Error upon calling SignHash");
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)) {
-        LogPrint("mnbudget","CBudgetVote::Sign - Error upon calling VerifyMessage");
+    if (!obfuScationSigner.VerifyHash(pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
+        LogPrint("mnbudget","CBudgetVote::Sign - Error upon calling VerifyHash");
         return false;
     }
 
     return true;
 }
 
+uint256 CBudgetVote::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime));
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("mvote") << nMessVersion << vin.prevout << nProposalHash << nVote << nTime;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
+}
+
+bool CBudgetVote::UpdateValid(bool fSignatureCheck, int nListVersion)
+{
+    // A check with the signature that passed also answers one without, and
+    // a check without it that failed (unknown masternode) also answers one with
+    if (nCheckedListVersion == nListVersion && (fCheckedSignature == fSignatureCheck || fValid == fCheckedSignature))
+        return fValid;
+
+    fValid = SignatureValid(fSignatureCheck);
+    nCheckedListVersion = nListVersion;
+    fCheckedSignature = fSignatureCheck;
+    return fValid;
+}
+
 bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nProposalHash.ToString() + boost::lexical_cast<std::string>(nVote) + boost::lexical_cast<std::string>(nTime);
 
     CMasternode* pmn = mnodeman.Find(vin);
 
@@ -1799,7 +1817,7 @@ bool CBudgetVote::SignatureValid(bool fSignatureCheck)
 
     if (!fSignatureCheck) return true;
 
-    if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyHash(pmn->pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
         LogPrint("mnbudget","CBudgetVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -1947,10 +1965,11 @@ void CFinalizedBudget::AutoCheck()
 // If masternode voted for a proposal, but is now invalid -- remove the vote
 void CFinalizedBudget::CleanAndRemove(bool fSignatureCheck)
 {
+    int nListVersion = mnodeman.GetListVersion();
     std::map<uint256, CFinalizedBudgetVote>::iterator it = mapVotes.begin();
 
     while (it != mapVotes.end()) {
-        (*it).second.fValid = (*it).second.SignatureValid(fSignatureCheck);
+        (*it).second.UpdateValid(fSignatureCheck, nListVersion);
         ++it;
     }
 }
@@ -2248,6 +2267,9 @@ CFinalizedBudgetVote::CFinalizedBudgetVote()
     vchSig.clear();
     fValid = true;
     fSynced = false;
+    nCheckedListVersion = -1;
+    fCheckedSignature = false;
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 CFinalizedBudgetVote::CFinalizedBudgetVote(CTxIn vinIn, uint256 nBudgetHashIn)
@@ -2258,6 +2280,9 @@ CFinalizedBudgetVote::CFinalizedBudgetVote(CTxIn vinIn, uint256 nBudgetHashIn)
     vchSig.clear();
     fValid = true;
     fSynced = false;
+    nCheckedListVersion = -1;
+    fCheckedSignature = false;
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 void CFinalizedBudgetVote::Relay()
@@ -2273,44 +2298,95 @@ bool CFinalizedBudgetVote::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
     CKey keyCollateralAddress;
 
     std::string errorMessage;
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
-        LogPrint("mnbudget","CFinalizedBudgetVote::Sign - Error upon calling SignMessage");
+    if (!obfuScationSigner.SignHash(GetSignatureHash(), errorMessage, vchSig, keyMasternode)) {
+        LogPrint("mnbudget","CFinalizedBudgetVote::Sign - Error upon calling SignHash");
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)) {
-        LogPrint("mnbudget","CFinalizedBudgetVote::Sign - Error upon calling VerifyMessage");
+    if (!obfuScationSigner.VerifyHash(pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
+        LogPrint("mnbudget","CFinalizedBudgetVote::Sign - Error upon calling VerifyHash");
         return false;
     }
 
     return true;
 }
 
+uint256 CFinalizedBudgetVote::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime));
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("fbvote") << nMessVersion << vin.prevout << nBudgetHash << nTime;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
+}
+
+bool CFinalizedBudgetVote::UpdateValid(bool fSignatureCheck, int nListVersion)
+{
+    // A check with the signature that passed also answers one without, and
+    // a check without it that failed (unknown masternode) also answers one with
+    if (nCheckedListVersion == nListVersion && (fCheckedSignature == fSignatureCheck || fValid == fCheckedSignature))
+        return fValid;
+
+    fValid = SignatureValid(fSignatureCheck);
+    nCheckedListVersion = nListVersion;
+    fCheckedSignature = fSignatureCheck;
+    return fValid;
+}
+
 bool CFinalizedBudgetVote::SignatureValid(bool fSignatureCheck)
 {
     std::string errorMessage;
 
-    std::string strMessage = vin.prevout.ToStringShort() + nBudgetHash.ToString() + boost::lexical_cast<std::string>(nTime);
-
     CMasternode* pmn = mnodeman.Find(vin);
 
     if (pmn == NULL) {
-        LogPrint("mnbudget","CFinalizedBudgetVote::SignatureValid() - Unknown Masternode %s\n", strMessage);
+        LogPrint("mnbudget","CFinalizedBudgetVote::SignatureValid() - Unknown Masternode %s\n", vin.prevout.ToStringShort());
         return false;
     }
 
     if (!fSignatureCheck) return true;
 
-    if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
-        LogPrint("mnbudget","CFinalizedBudgetVote::SignatureValid() - Verify message failed %s %s\n", strMessage, errorMessage);
+    if (!obfuScationSigner.VerifyHash(pmn->pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
+        LogPrint("mnbudget","CFinalizedBudgetVote::SignatureValid() - Verify message failed %s %s\n", vin.prevout.ToStringShort(), errorMessage);
         return false;
     }
 
     return true;
 }
 
+bool CBudgetManager::WriteState(CMasternodeStateDB& db)
+{
+    LOCK(cs);
+
+    // The seen maps are rebuilt from the network after a restart, see ClearSeen
+    return db.WriteMap('p', mapProposals) &&
+           db.WriteMap('f', mapFinalizedBudgets) &&
+           db.WriteMap('o', mapOrphanMasternodeBudgetVotes) &&
+           db.WriteMap('q', mapOrphanFinalizedBudgetVotes);
+}
+
+bool CBudgetManager::ReadState(CMasternodeStateDB& db)
+{
+    LOCK(cs);
+
+    if (!db.ReadMap('p', mapProposals) ||
+        !db.ReadMap('f', mapFinalizedBudgets) ||
+        !db.ReadMap('o', mapOrphanMasternodeBudgetVotes) ||
+        !db.ReadMap('q', mapOrphanFinalizedBudgetVotes)) {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
 std::string CBudgetManager::ToString() const
 {
     std::ostringstream info;
@@ -22,6 +22,7 @@ using namespace std;
 extern CCriticalSection cs_budget;
 
 class CBudgetManager;
+class CMasternodeStateDB;
 class CFinalizedBudgetBroadcast;
 class CFinalizedBudget;
 class CBudgetProposal;
@@ -49,7 +50,10 @@ extern std::vector<CBudgetProposalBroadcast> vecImmatureBudgetProposals;
 extern std::vector<CFinalizedBudgetBroadcast> vecImmatureFinalizedBudgets;
 
 extern CBudgetManager budget;
+/** Write the budget proposals and finalized budgets that changed to the masternode state database */
 void DumpBudgets();
+/** Load the budgets, from budget.dat of older versions once if fImportCacheFile */
+void LoadBudgets(bool fImportCacheFile);
 
 // Define amount of blocks in budget payment cycle
 int GetBudgetPaymentCycleBlocks();
@@ -63,22 +67,33 @@ bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, s
 
 class CBudgetVote
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     bool fValid;  //if the vote is currently valid / counted
     bool fSynced; //if we've sent this to our peers
+    int nCheckedListVersion; //masternode list version fValid was last worked out against, -1 if never
+    bool fCheckedSignature;  //if that check covered the signature too
     CTxIn vin;
     uint256 nProposalHash;
     int nVote;
     int64_t nTime;
     std::vector<unsigned char> vchSig;
+    int nMessVersion;
 
     CBudgetVote();
     CBudgetVote(CTxIn vin, uint256 nProposalHash, int nVoteIn);
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    /// Work out fValid again unless the masternode list is unchanged since the last check, returns fValid
+    bool UpdateValid(bool fSignatureCheck, int nListVersion);
     void Relay();
 
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
+
     std::string GetVoteString()
     {
         std::string ret = "ABSTAIN";
@@ -107,6 +122,10 @@ public:
         READWRITE(nVote);
         READWRITE(nTime);
         READWRITE(vchSig);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 };
 
@@ -116,21 +135,32 @@ public:
 
 class CFinalizedBudgetVote
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     bool fValid;  //if the vote is currently valid / counted
     bool fSynced; //if we've sent this to our peers
+    int nCheckedListVersion; //masternode list version fValid was last worked out against, -1 if never
+    bool fCheckedSignature;  //if that check covered the signature too
     CTxIn vin;
     uint256 nBudgetHash;
     int64_t nTime;
     std::vector<unsigned char> vchSig;
+    int nMessVersion;
 
     CFinalizedBudgetVote();
     CFinalizedBudgetVote(CTxIn vinIn, uint256 nBudgetHashIn);
 
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool SignatureValid(bool fSignatureCheck);
+    /// Work out fValid again unless the masternode list is unchanged since the last check, returns fValid
+    bool UpdateValid(bool fSignatureCheck, int nListVersion);
     void Relay();
 
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
+
     uint256 GetHash()
     {
         CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
@@ -149,10 +179,14 @@ public:
         READWRITE(nBudgetHash);
         READWRITE(nTime);
         READWRITE(vchSig);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 };
 
-/** Save Budget Manager (budget.dat)
+/** Budget Manager file of older versions (budget.dat)
  */
 class CBudgetDB
 {
@@ -172,7 +206,6 @@ public:
     };
 
     CBudgetDB();
-    bool Write(const CBudgetManager& objToSave);
     ReadResult Read(CBudgetManager& objToLoad, bool fDryRun = false);
 };
 
@@ -265,6 +298,11 @@ public:
     void CheckAndRemove();
     std::string ToString() const;
 
+    /// Store the proposals, finalized budgets and orphan votes that changed since the last call
+    bool WriteState(CMasternodeStateDB& db);
+    /// Load everything stored by WriteState
+    bool ReadState(CMasternodeStateDB& db);
+
 
     ADD_SERIALIZE_METHODS;
 
@@ -467,6 +505,16 @@ private:
     mutable CCriticalSection cs;
     CAmount nAlloted;
 
+    // running tallies of mapVotes by vote type, kept by AddOrUpdateVote and CleanAndRemove
+    int nVotes[VOTE_NO + 1];      //every vote, as GetRatio counts them
+    int nValidVotes[VOTE_NO + 1]; //only the votes currently valid
+
+    void CountVote(const CBudgetVote& vote, int nDelta);
+
+protected:
+    /// Recount the tallies from mapVotes
+    void Tally();
+
 public:
     bool fValid;
     std::string strProposalName;
@@ -558,6 +606,8 @@ public:
 
         //for saving to the serialized db
         READWRITE(mapVotes);
+        if (ser_action.ForRead())
+            Tally();
     }
 };
 
@@ -586,6 +636,8 @@ public:
         swap(first.nTime, second.nTime);
         swap(first.nFeeTXHash, second.nFeeTXHash);
         first.mapVotes.swap(second.mapVotes);
+        first.Tally();
+        second.Tally();
     }
 
     CBudgetProposalBroadcast& operator=(CBudgetProposalBroadcast from)
@@ -8,6 +8,7 @@
 #include "addrman.h"
 #include "masternode-budget.h"
 #include "masternode-sync.h"
+#include "masternodedb.h"
 #include "masternodeman.h"
 #include "obfuscation.h"
 #include "spork.h"
@@ -36,37 +37,6 @@ CMasternodePaymentDB::CMasternodePaymentDB()
     strMagicMessage = "MasternodePayments";
 }
 
-bool CMasternodePaymentDB::Write(const CMasternodePayments& objToSave)
-{
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
-
-    LogPrint("masternode","Written info to mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
-
-    return true;
-}
-
 CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments& objToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
@@ -151,29 +121,45 @@ CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments&
 
 void DumpMasternodePayments()
 {
+    if (pMasternodeStateDB == NULL)
+        return;
+
     int64_t nStart = GetTimeMillis();
+    if (!masternodePayments.WriteState(*pMasternodeStateDB))
+        LogPrintf("Error writing masternode payment state\n");
 
-    CMasternodePaymentDB paymentdb;
-    CMasternodePayments tempPayments;
-
-    LogPrint("masternode","Verifying mnpayments.dat format...\n");
-    CMasternodePaymentDB::ReadResult readResult = paymentdb.Read(tempPayments, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodePaymentDB::FileError)
-        LogPrint("masternode","Missing budgets file - mnpayments.dat, will try to recreate\n");
-    else if (readResult != CMasternodePaymentDB::Ok) {
-        LogPrint("masternode","Error reading mnpayments.dat: ");
-        if (readResult == CMasternodePaymentDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
+    LogPrint("masternode","Masternode payments dump finished  %dms\n", GetTimeMillis() - nStart);
+}
+
+void LoadMasternodePayments(bool fImportCacheFile)
+{
+    if (fImportCacheFile) {
+        CMasternodePaymentDB mnpayments;
+        CMasternodePaymentDB::ReadResult readResult = mnpayments.Read(masternodePayments);
+        if (readResult == CMasternodePaymentDB::FileError)
+            LogPrintf("Missing masternode payment cache - mnpayments.dat, will try to recreate\n");
+        else if (readResult != CMasternodePaymentDB::Ok) {
+            LogPrintf("Error reading mnpayments.dat: ");
+            if (readResult == CMasternodePaymentDB::IncorrectFormat)
+                LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+            else
+                LogPrintf("file format is unknown or invalid, please fix it manually\n");
         }
+        return;
     }
-    LogPrint("masternode","Writting info to mnpayments.dat...\n");
-    paymentdb.Write(masternodePayments);
 
-    LogPrint("masternode","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+    int64_t nStart = GetTimeMillis();
+    if (!masternodePayments.ReadState(*pMasternodeStateDB)) {
+        LogPrintf("Error reading masternode payment state, will try to recreate\n");
+        return;
+    }
+
+    LogPrint("masternode","Loaded masternode payment state  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","  %s\n", masternodePayments.ToString());
+    LogPrint("masternode","Masternode payments manager - cleaning....\n");
+    masternodePayments.CleanPaymentList();
+    LogPrint("masternode","Masternode payments manager - result:\n");
+    LogPrint("masternode","  %s\n", masternodePayments.ToString());
 }
 
 bool IsBlockValueValid(const CBlock& block, CAmount nExpectedValue, CAmount nMinted)
@@ -508,18 +494,16 @@ void CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
 bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
 {
     std::string errorMessage;
-    std::string strMasterNodeSignMessage;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                             boost::lexical_cast<std::string>(nBlockHeight) +
-                             payee.ToString();
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
+    if (!obfuScationSigner.SignHash(GetSignatureHash(), errorMessage, vchSig, keyMasternode)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage.c_str());
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyHash(pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage.c_str());
         return false;
     }
@@ -527,10 +511,29 @@ bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasterno
     return true;
 }
 
+uint256 CMasternodePaymentWinner::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(vinMasternode.prevout.ToStringShort() +
+                                                             boost::lexical_cast<std::string>(nBlockHeight) +
+                                                             payee.ToString());
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("mnw") << nMessVersion << vinMasternode.prevout << nBlockHeight << payee;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
+}
+
 bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 {
-    if (mapMasternodeBlocks.count(nBlockHeight)) {
-        return mapMasternodeBlocks[nBlockHeight].GetPayee(payee);
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it != mapMasternodeBlocks.end()) {
+        return it->second.GetPayee(payee);
     }
 
     return false;
@@ -552,21 +555,42 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
     CScript mnpayee;
     mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
 
-    CScript payee;
-    for (int64_t h = nHeight; h <= nHeight + 8; h++) {
-        if (h == nNotBlockHeight) continue;
-        if (mapMasternodeBlocks.count(h)) {
-            if (mapMasternodeBlocks[h].GetPayee(payee)) {
-                if (mnpayee == payee) {
-                    return true;
-                }
-            }
-        }
+    std::map<CScript, std::set<int> >::const_iterator it = mapScheduledHeights.find(mnpayee);
+    if (it == mapScheduledHeights.end()) return false;
+
+    std::set<int>::const_iterator itHeight = it->second.lower_bound(nHeight);
+    for (; itHeight != it->second.end() && *itHeight <= nHeight + 8; ++itHeight) {
+        if (*itHeight != nNotBlockHeight) return true;
     }
 
     return false;
 }
 
+void CMasternodePayments::Unschedule(const CScript& payee, int nBlockHeight)
+{
+    std::map<CScript, std::set<int> >::iterator it = mapScheduledHeights.find(payee);
+    if (it == mapScheduledHeights.end()) return;
+
+    it->second.erase(nBlockHeight);
+    if (it->second.empty()) mapScheduledHeights.erase(it);
+}
+
+void CMasternodePayments::RebuildIndexes()
+{
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+
+    mapPayeeVotesByHeight.clear();
+    for (std::map<uint256, CMasternodePaymentWinner>::iterator it = mapMasternodePayeeVotes.begin(); it != mapMasternodePayeeVotes.end(); ++it)
+        mapPayeeVotesByHeight.insert(std::make_pair(it->second.nBlockHeight, it->first));
+
+    mapScheduledHeights.clear();
+    CScript payee;
+    for (std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin(); it != mapMasternodeBlocks.end(); ++it) {
+        if (it->second.GetPayee(payee))
+            mapScheduledHeights[payee].insert(it->first);
+    }
+}
+
 bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerIn)
 {
     uint256 blockHash = 0;
@@ -574,22 +598,29 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
         return false;
     }
 
-    {
-        LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
 
-        if (mapMasternodePayeeVotes.count(winnerIn.GetHash())) {
-            return false;
-        }
+    uint256 hash = winnerIn.GetHash();
+    if (mapMasternodePayeeVotes.count(hash)) {
+        return false;
+    }
 
-        mapMasternodePayeeVotes[winnerIn.GetHash()] = winnerIn;
+    mapMasternodePayeeVotes[hash] = winnerIn;
+    mapPayeeVotesByHeight.insert(std::make_pair(winnerIn.nBlockHeight, hash));
 
-        if (!mapMasternodeBlocks.count(winnerIn.nBlockHeight)) {
-            CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
-            mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
-        }
-    }
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(winnerIn.nBlockHeight);
+    if (it == mapMasternodeBlocks.end())
+        it = mapMasternodeBlocks.insert(std::make_pair(winnerIn.nBlockHeight, CMasternodeBlockPayees(winnerIn.nBlockHeight))).first;
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    // keep mapScheduledHeights on the payee with the most votes
+    CScript payeeBefore, payeeAfter;
+    bool fHadPayee = it->second.GetPayee(payeeBefore);
+    it->second.AddPayee(winnerIn.payee, 1);
+    it->second.GetPayee(payeeAfter);
+    if (!fHadPayee || payeeBefore != payeeAfter) {
+        if (fHadPayee) Unschedule(payeeBefore, winnerIn.nBlockHeight);
+        mapScheduledHeights[payeeAfter].insert(winnerIn.nBlockHeight);
+    }
 
     return true;
 }
@@ -601,8 +632,6 @@ bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
     int nMaxSignatures = 0;
     int nMasternode_Drift_Count = 0;
 
-    std::string strPayeesPossible = "";
-
     CAmount nReward = GetBlockValue(nBlockHeight);
 
     if (IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
@@ -626,30 +655,31 @@ bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
     // if we don't have at least 6 signatures on a payee, approve whichever is the longest chain
     if (nMaxSignatures < MNPAYMENTS_SIGNATURES_REQUIRED) return true;
 
+    // only payees with enough signatures can make the payment valid
     BOOST_FOREACH (CMasternodePayee& payee, vecPayments) {
-        bool found = false;
-        BOOST_FOREACH (CTxOut out, txNew.vout) {
-            if (payee.scriptPubKey == out.scriptPubKey) {
-                if(nBlockHeight <= REV_BLOCK && out.nValue <= requiredMasternodePayment) {
-                    found = true;
-                    if (fDebug)
-                        LogPrint("masternode","Masternode payment was made successfully. Paid=%s Max=%s Blocks=%s Reward=%s\n",
-                                  FormatMoney(out.nValue).c_str(), FormatMoney(requiredMasternodePayment).c_str(), nBlockHeight, FormatMoney(nReward).c_str());
-                }
-                else if(nBlockHeight > REV_BLOCK && out.nValue >= requiredMasternodePayment) {
-                    found = true;
-                    if (fDebug)
-                        LogPrint("masternode","Masternode payment was made successfully. Paid=%s Min=%s Blocks=%s Reward=%s\n",
-                                  FormatMoney(out.nValue).c_str(), FormatMoney(requiredMasternodePayment).c_str(), nBlockHeight, FormatMoney(nReward).c_str());
-                }
-                else
-                    LogPrint("masternode","Masternode payment is out of drift range. Paid=%s Min=%s Blocks=%s Reward=%s\n",
-                              FormatMoney(out.nValue).c_str(), FormatMoney(requiredMasternodePayment).c_str(), nBlockHeight, FormatMoney(nReward).c_str());
+        if (payee.nVotes < MNPAYMENTS_SIGNATURES_REQUIRED) continue;
+
+        BOOST_FOREACH (const CTxOut& out, txNew.vout) {
+            if (payee.scriptPubKey != out.scriptPubKey) continue;
+
+            bool fInRange = nBlockHeight <= REV_BLOCK ? out.nValue <= requiredMasternodePayment : out.nValue >= requiredMasternodePayment;
+            if (fInRange) {
+                if (fDebug)
+                    LogPrint("masternode","Masternode payment was made successfully. Paid=%s %s=%s Blocks=%s Reward=%s\n",
+                              FormatMoney(out.nValue).c_str(), nBlockHeight <= REV_BLOCK ? "Max" : "Min", FormatMoney(requiredMasternodePayment).c_str(), nBlockHeight, FormatMoney(nReward).c_str());
+                return true;
             }
+
+            if (fDebug)
+                LogPrint("masternode","Masternode payment is out of drift range. Paid=%s Min=%s Blocks=%s Reward=%s\n",
+                          FormatMoney(out.nValue).c_str(), FormatMoney(requiredMasternodePayment).c_str(), nBlockHeight, FormatMoney(nReward).c_str());
         }
+    }
 
-        if (payee.nVotes >= MNPAYMENTS_SIGNATURES_REQUIRED) {
-            if (found) return true;
+    if (fDebug) {
+        std::string strPayeesPossible = "";
+        BOOST_FOREACH (CMasternodePayee& payee, vecPayments) {
+            if (payee.nVotes < MNPAYMENTS_SIGNATURES_REQUIRED) continue;
 
             CTxDestination address1;
             ExtractDestination(payee.scriptPubKey, address1);
@@ -661,9 +691,8 @@ bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
                 strPayeesPossible += "," + address2.ToString();
             }
         }
+        LogPrint("masternode","CMasternodePayments::IsTransactionValid - Missing required payment of %s to %s\n", FormatMoney(requiredMasternodePayment).c_str(), strPayeesPossible.c_str());
     }
-
-    LogPrint("masternode","CMasternodePayments::IsTransactionValid - Missing required payment of %s to %s\n", FormatMoney(requiredMasternodePayment).c_str(), strPayeesPossible.c_str());
     return false;
 }
 
@@ -692,8 +721,9 @@ std::string CMasternodePayments::GetRequiredPaymentsString(int nBlockHeight)
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    if (mapMasternodeBlocks.count(nBlockHeight)) {
-        return mapMasternodeBlocks[nBlockHeight].GetRequiredPaymentsString();
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it != mapMasternodeBlocks.end()) {
+        return it->second.GetRequiredPaymentsString();
     }
 
     return "Unknown";
@@ -703,8 +733,9 @@ bool CMasternodePayments::IsTransactionValid(const CTransaction& txNew, int nBlo
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    if (mapMasternodeBlocks.count(nBlockHeight)) {
-        return mapMasternodeBlocks[nBlockHeight].IsTransactionValid(txNew);
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it != mapMasternodeBlocks.end()) {
+        return it->second.IsTransactionValid(txNew);
     }
 
     return true;
@@ -724,19 +755,22 @@ void CMasternodePayments::CleanPaymentList()
     //keep up to five cycles for historical sake
     int nLimit = std::max(int(mnodeman.size() * 1.25), 1000);
 
-    std::map<uint256, CMasternodePaymentWinner>::iterator it = mapMasternodePayeeVotes.begin();
-    while (it != mapMasternodePayeeVotes.end()) {
-        CMasternodePaymentWinner winner = (*it).second;
+    // everything below nHeight - nLimit goes, the indexes are ordered by height
+    std::multimap<int, uint256>::iterator itVotesEnd = mapPayeeVotesByHeight.lower_bound(nHeight - nLimit);
+    for (std::multimap<int, uint256>::iterator it = mapPayeeVotesByHeight.begin(); it != itVotesEnd; ++it) {
+        LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", it->first);
+        masternodeSync.mapSeenSyncMNW.erase(it->second);
+        mapMasternodePayeeVotes.erase(it->second);
+    }
+    mapPayeeVotesByHeight.erase(mapPayeeVotesByHeight.begin(), itVotesEnd);
 
-        if (nHeight - winner.nBlockHeight > nLimit) {
-            LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
-            masternodeSync.mapSeenSyncMNW.erase((*it).first);
-            mapMasternodePayeeVotes.erase(it++);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
-        } else {
-            ++it;
-        }
+    std::map<int, CMasternodeBlockPayees>::iterator itBlocksEnd = mapMasternodeBlocks.lower_bound(nHeight - nLimit);
+    CScript payee;
+    for (std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin(); it != itBlocksEnd; ++it) {
+        if (it->second.GetPayee(payee))
+            Unschedule(payee, it->first);
     }
+    mapMasternodeBlocks.erase(mapMasternodeBlocks.begin(), itBlocksEnd);
 }
 
 bool CMasternodePaymentWinner::IsValid(CNode* pnode, std::string& strError)
@@ -855,12 +889,8 @@ bool CMasternodePaymentWinner::SignatureValid()
     CMasternode* pmn = mnodeman.Find(vinMasternode);
 
     if (pmn != NULL) {
-        std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                                 boost::lexical_cast<std::string>(nBlockHeight) +
-                                 payee.ToString();
-
         std::string errorMessage = "";
-        if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+        if (!obfuScationSigner.VerifyHash(pmn->pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
             return error("CMasternodePaymentWinner::SignatureValid() - Got bad Masternode address signature %s\n", vinMasternode.prevout.hash.ToString());
         }
 
@@ -885,18 +915,35 @@ void CMasternodePayments::Sync(CNode* node, int nCountNeeded)
     if (nCountNeeded > nCount) nCountNeeded = nCount;
 
     int nInvCount = 0;
-    std::map<uint256, CMasternodePaymentWinner>::iterator it = mapMasternodePayeeVotes.begin();
-    while (it != mapMasternodePayeeVotes.end()) {
-        CMasternodePaymentWinner winner = (*it).second;
-        if (winner.nBlockHeight >= nHeight - nCountNeeded && winner.nBlockHeight <= nHeight + 20) {
-            node->PushInventory(CInv(MSG_MASTERNODE_WINNER, winner.GetHash()));
-            nInvCount++;
-        }
-        ++it;
+    std::multimap<int, uint256>::iterator it = mapPayeeVotesByHeight.lower_bound(nHeight - nCountNeeded);
+    std::multimap<int, uint256>::iterator itEnd = mapPayeeVotesByHeight.upper_bound(nHeight + 20);
+    for (; it != itEnd; ++it) {
+        node->PushInventory(CInv(MSG_MASTERNODE_WINNER, it->second));
+        nInvCount++;
     }
     node->PushMessage("ssc", MASTERNODE_SYNC_MNW, nInvCount);
 }
 
+bool CMasternodePayments::WriteState(CMasternodeStateDB& db)
+{
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+
+    return db.WriteMap('w', mapMasternodePayeeVotes) &&
+           db.WriteMap('k', mapMasternodeBlocks);
+}
+
+bool CMasternodePayments::ReadState(CMasternodeStateDB& db)
+{
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+
+    if (!db.ReadMap('w', mapMasternodePayeeVotes) || !db.ReadMap('k', mapMasternodeBlocks)) {
+        Clear();
+        return false;
+    }
+    RebuildIndexes();
+    return true;
+}
+
 std::string CMasternodePayments::ToString() const
 {
     std::ostringstream info;
@@ -911,17 +958,8 @@ int CMasternodePayments::GetOldestBlock()
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    int nOldestBlock = std::numeric_limits<int>::max();
-
-    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin();
-    while (it != mapMasternodeBlocks.end()) {
-        if ((*it).first < nOldestBlock) {
-            nOldestBlock = (*it).first;
-        }
-        it++;
-    }
-
-    return nOldestBlock;
+    if (mapMasternodeBlocks.empty()) return std::numeric_limits<int>::max();
+    return mapMasternodeBlocks.begin()->first;
 }
 
 
@@ -929,15 +967,6 @@ int CMasternodePayments::GetNewestBlock()
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    int nNewestBlock = 0;
-
-    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin();
-    while (it != mapMasternodeBlocks.end()) {
-        if ((*it).first > nNewestBlock) {
-            nNewestBlock = (*it).first;
-        }
-        it++;
-    }
-
-    return nNewestBlock;
+    if (mapMasternodeBlocks.empty()) return 0;
+    return std::max(mapMasternodeBlocks.rbegin()->first, 0);
 }
@@ -19,6 +19,7 @@ extern CCriticalSection cs_mapMasternodeBlocks;
 extern CCriticalSection cs_mapMasternodePayeeVotes;
 
 class CMasternodePayments;
+class CMasternodeStateDB;
 class CMasternodePaymentWinner;
 class CMasternodeBlockPayees;
 
@@ -33,9 +34,12 @@ std::string GetRequiredPaymentsString(int nBlockHeight);
 bool IsBlockValueValid(const CBlock& block, CAmount nExpectedValue, CAmount nMinted);
 void FillBlockPayee(CMutableTransaction& txNew, CAmount nFees, bool fProofOfStake, bool fZQBICStake);
 
+/** Write the masternode payment votes that changed to the masternode state database */
 void DumpMasternodePayments();
+/** Load the masternode payment votes, from mnpayments.dat of older versions once if fImportCacheFile */
+void LoadMasternodePayments(bool fImportCacheFile);
 
-/** Save Masternode Payment Data (mnpayments.dat)
+/** Masternode Payment Data file of older versions (mnpayments.dat)
  */
 class CMasternodePaymentDB
 {
@@ -55,7 +59,6 @@ public:
     };
 
     CMasternodePaymentDB();
-    bool Write(const CMasternodePayments& objToSave);
     ReadResult Read(CMasternodePayments& objToLoad, bool fDryRun = false);
 };
 
@@ -162,18 +165,23 @@ public:
 // for storing the winning payments
 class CMasternodePaymentWinner
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     CTxIn vinMasternode;
 
     int nBlockHeight;
     CScript payee;
     std::vector<unsigned char> vchSig;
+    int nMessVersion;
 
     CMasternodePaymentWinner()
     {
         nBlockHeight = 0;
         vinMasternode = CTxIn();
         payee = CScript();
+        nMessVersion = MESS_VER_STRMESS;
     }
 
     CMasternodePaymentWinner(CTxIn vinIn)
@@ -181,6 +189,7 @@ public:
         nBlockHeight = 0;
         vinMasternode = vinIn;
         payee = CScript();
+        nMessVersion = MESS_VER_STRMESS;
     }
 
     uint256 GetHash()
@@ -198,6 +207,9 @@ public:
     bool SignatureValid();
     void Relay();
 
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
+
     void AddPayee(CScript payeeIn)
     {
         payee = payeeIn;
@@ -213,6 +225,10 @@ public:
         READWRITE(nBlockHeight);
         READWRITE(payee);
         READWRITE(vchSig);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 
     std::string ToString()
@@ -237,6 +253,15 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    //! hashes of mapMasternodePayeeVotes by block height, protected by cs_mapMasternodePayeeVotes
+    std::multimap<int, uint256> mapPayeeVotesByHeight;
+    //! heights in mapMasternodeBlocks at which a payee has the most votes, protected by cs_mapMasternodeBlocks
+    std::map<CScript, std::set<int> > mapScheduledHeights;
+
+    void Unschedule(const CScript& payee, int nBlockHeight);
+    /// Recompute the indexes above from mapMasternodePayeeVotes and mapMasternodeBlocks
+    void RebuildIndexes();
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -250,9 +275,11 @@ public:
 
     void Clear()
     {
-        LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
+        LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeVotesByHeight.clear();
+        mapScheduledHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -289,6 +316,11 @@ public:
     int GetOldestBlock();
     int GetNewestBlock();
 
+    /// Store the votes and payees that changed since the last call
+    bool WriteState(CMasternodeStateDB& db);
+    /// Load everything stored by WriteState
+    bool ReadState(CMasternodeStateDB& db);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -296,6 +328,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildIndexes();
     }
 };
 
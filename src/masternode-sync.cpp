@@ -235,7 +235,7 @@ void CMasternodeSync::Process()
 {
     static int tick = 0;
 
-    if (tick++ % MASTERNODE_SYNC_TIMEOUT != 0) return;
+    tick++;
 
     if (IsSynced()) {
         /* 
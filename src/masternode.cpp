@@ -78,6 +78,7 @@ CMasternode::CMasternode()
     nLastDsq = 0;
     nScanningErrorCount = 0;
     nLastScanningErrorBlockHeight = 0;
+    nMessVersion = MESS_VER_STRMESS;
     lastTimeChecked = 0;
     nLastDsee = 0;  // temporary, do not save. Remove after migration to v12
     nLastDseep = 0; // temporary, do not save. Remove after migration to v12
@@ -103,6 +104,7 @@ CMasternode::CMasternode(const CMasternode& other)
     nLastDsq = other.nLastDsq;
     nScanningErrorCount = other.nScanningErrorCount;
     nLastScanningErrorBlockHeight = other.nLastScanningErrorBlockHeight;
+    nMessVersion = other.nMessVersion;
     lastTimeChecked = 0;
     nLastDsee = other.nLastDsee;   // temporary, do not save. Remove after migration to v12
     nLastDseep = other.nLastDseep; // temporary, do not save. Remove after migration to v12
@@ -128,6 +130,7 @@ CMasternode::CMasternode(const CMasternodeBroadcast& mnb)
     nLastDsq = mnb.nLastDsq;
     nScanningErrorCount = 0;
     nLastScanningErrorBlockHeight = 0;
+    nMessVersion = mnb.nMessVersion;
     lastTimeChecked = 0;
     nLastDsee = 0;  // temporary, do not save. Remove after migration to v12
     nLastDseep = 0; // temporary, do not save. Remove after migration to v12
@@ -139,10 +142,13 @@ CMasternode::CMasternode(const CMasternodeBroadcast& mnb)
 bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb)
 {
     if (mnb.sigTime > sigTime) {
+        if (pubKeyMasternode != mnb.pubKeyMasternode)
+            mnodeman.MasternodeKeyChanged();
         pubKeyMasternode = mnb.pubKeyMasternode;
         pubKeyCollateralAddress = mnb.pubKeyCollateralAddress;
         sigTime = mnb.sigTime;
         sig = mnb.sig;
+        nMessVersion = mnb.nMessVersion;
         protocolVersion = mnb.protocolVersion;
         addr = mnb.addr;
         lastTimeChecked = 0;
@@ -389,6 +395,7 @@ CMasternodeBroadcast::CMasternodeBroadcast(const CMasternode& mn)
     nLastDsq = mn.nLastDsq;
     nScanningErrorCount = mn.nScanningErrorCount;
     nLastScanningErrorBlockHeight = mn.nLastScanningErrorBlockHeight;
+    nMessVersion = mn.nMessVersion;
 }
 
 bool CMasternodeBroadcast::Create(std::string strService, std::string strKeyMasternode, std::string strTxHash, std::string strOutputIndex, std::string& strErrorRet, CMasternodeBroadcast& mnbRet, bool fOffline)
@@ -518,13 +525,10 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
         return false;
     }
 
-    std::string errorMessage = "";
-    if (!obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, GetNewStrMessage(), errorMessage)
-    		&& !obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, GetOldStrMessage(), errorMessage))
-    {
+    if (!VerifySignature()) {
         // don't ban for old masternodes, their sigs could be broken because of the bug
         nDos = protocolVersion < MIN_PEER_MNANNOUNCE ? 0 : 100;
-        return error("CMasternodeBroadcast::CheckAndUpdate - Got bad Masternode address signature : %s", errorMessage);
+        return error("CMasternodeBroadcast::CheckAndUpdate - Got bad Masternode address signature");
     }
 
     if (Params().NetworkID() == CBaseChainParams::MAIN) {
@@ -660,17 +664,19 @@ bool CMasternodeBroadcast::Sign(CKey& keyCollateralAddress)
 {
     std::string errorMessage;
     sigTime = GetAdjustedTime();
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
 
-    std::string strMessage;
-    if(chainActive.Height() < Params().Zerocoin_Block_V2_Start())
-    	strMessage = GetOldStrMessage();
+    uint256 hash;
+    if (nMessVersion == MESS_VER_STRMESS && chainActive.Height() < Params().Zerocoin_Block_V2_Start())
+        hash = obfuScationSigner.GetMessageHash(GetOldStrMessage());
     else
-    	strMessage = GetNewStrMessage();
+        hash = GetSignatureHash();
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, sig, keyCollateralAddress))
+    if (!obfuScationSigner.SignHash(hash, errorMessage, sig, keyCollateralAddress))
     	return error("CMasternodeBroadcast::Sign() - Error: %s", errorMessage);
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, strMessage, errorMessage))
+    if (!obfuScationSigner.VerifyHash(pubKeyCollateralAddress, sig, hash, errorMessage))
     	return error("CMasternodeBroadcast::Sign() - Error: %s", errorMessage);
 
     return true;
@@ -681,14 +687,31 @@ bool CMasternodeBroadcast::VerifySignature()
 {
     std::string errorMessage;
 
-    if(!obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, GetNewStrMessage(), errorMessage)
-            && !obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, GetOldStrMessage(), errorMessage))
-        return error("CMasternodeBroadcast::VerifySignature() - Error: %s", errorMessage);
+    if (obfuScationSigner.VerifyHash(pubKeyCollateralAddress, sig, GetSignatureHash(), errorMessage))
+        return true;
 
-    return true;
+    // Broadcasts signed before the zerocoin v2 start use the old string format
+    if (nMessVersion == MESS_VER_STRMESS && obfuScationSigner.VerifyMessage(pubKeyCollateralAddress, sig, GetOldStrMessage(), errorMessage))
+        return true;
+
+    return error("CMasternodeBroadcast::VerifySignature() - Error: %s", errorMessage);
+}
+
+uint256 CMasternodeBroadcast::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(GetNewStrMessage());
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("mnb") << nMessVersion << vin << addr << pubKeyCollateralAddress << pubKeyMasternode << sigTime << protocolVersion;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
 }
 
-std::string CMasternodeBroadcast::GetOldStrMessage()
+std::string CMasternodeBroadcast::GetOldStrMessage() const
 {
     std::string strMessage;
 
@@ -699,7 +722,7 @@ std::string CMasternodeBroadcast::GetOldStrMessage()
     return strMessage;
 }
 
-std:: string CMasternodeBroadcast::GetNewStrMessage()
+std::string CMasternodeBroadcast::GetNewStrMessage() const
 {
     std::string strMessage;
 
@@ -714,6 +737,7 @@ CMasternodePing::CMasternodePing()
     blockHash = uint256(0);
     sigTime = 0;
     vchSig = std::vector<unsigned char>();
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 CMasternodePing::CMasternodePing(CTxIn& newVin)
@@ -722,23 +746,24 @@ CMasternodePing::CMasternodePing(CTxIn& newVin)
     blockHash = chainActive[chainActive.Height() - 12]->GetBlockHash();
     sigTime = GetAdjustedTime();
     vchSig = std::vector<unsigned char>();
+    nMessVersion = MESS_VER_STRMESS;
 }
 
 
 bool CMasternodePing::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
 {
     std::string errorMessage;
-    std::string strMasterNodeSignMessage;
 
     sigTime = GetAdjustedTime();
-    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
+    if (!obfuScationSigner.SignHash(GetSignatureHash(), errorMessage, vchSig, keyMasternode)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage);
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyHash(pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)) {
         LogPrint("masternode","CMasternodePing::Sign() - Error: %s\n", errorMessage);
         return false;
     }
@@ -747,16 +772,29 @@ bool CMasternodePing::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
 }
 
 bool CMasternodePing::VerifySignature(CPubKey& pubKeyMasternode, int &nDos) {
-	std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
 	std::string errorMessage = "";
 
-	if(!obfuScationSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, errorMessage)){
+	if(!obfuScationSigner.VerifyHash(pubKeyMasternode, vchSig, GetSignatureHash(), errorMessage)){
 		nDos = 33;
 		return error("CMasternodePing::VerifySignature - Got bad Masternode ping signature %s Error: %s", vin.ToString(), errorMessage);
 	}
 	return true;
 }
 
+uint256 CMasternodePing::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime));
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("mnp") << nMessVersion << vin << blockHash << sigTime;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
+}
+
 bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, bool fCheckSigTimeOnly)
 {
     if (sigTime > GetAdjustedTime() + 60 * 60) {
@@ -25,6 +25,12 @@
 
 using namespace std;
 
+/** What the signature of a masternode, SwiftX or budget message covers */
+enum MessageVersion {
+    MESS_VER_STRMESS = 0, //! the legacy string formatting of the signed fields
+    MESS_VER_HASH = 1,    //! a digest of the binary serialization of the signed fields
+};
+
 class CMasternode;
 class CMasternodeBroadcast;
 class CMasternodePing;
@@ -39,11 +45,15 @@ bool GetBlockHash(uint256& hash, int nBlockHeight);
 
 class CMasternodePing
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     CTxIn vin;
     uint256 blockHash;
     int64_t sigTime; //mnb message times
     std::vector<unsigned char> vchSig;
+    int nMessVersion;
     //removed stop
 
     CMasternodePing();
@@ -58,6 +68,10 @@ public:
         READWRITE(blockHash);
         READWRITE(sigTime);
         READWRITE(vchSig);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true, bool fCheckSigTimeOnly = false);
@@ -65,6 +79,9 @@ public:
     bool VerifySignature(CPubKey& pubKeyMasternode, int &nDos);
     void Relay();
 
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
+
     uint256 GetHash()
     {
         CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
@@ -84,6 +101,8 @@ public:
         swap(first.blockHash, second.blockHash);
         swap(first.sigTime, second.sigTime);
         swap(first.vchSig, second.vchSig);
+        swap(first.nMessVersion, second.nMessVersion);
+        swap(first.hashSignature, second.hashSignature);
     }
 
     CMasternodePing& operator=(CMasternodePing from)
@@ -144,6 +163,7 @@ public:
     int nScanningErrorCount;
     int nLastScanningErrorBlockHeight;
     CMasternodePing lastPing;
+    int nMessVersion; //! format of the broadcast signature
 
     int64_t nLastDsee;  // temporary, do not save. Remove after migration to v12
     int64_t nLastDseep; // temporary, do not save. Remove after migration to v12
@@ -176,6 +196,7 @@ public:
         swap(first.nLastDsq, second.nLastDsq);
         swap(first.nScanningErrorCount, second.nScanningErrorCount);
         swap(first.nLastScanningErrorBlockHeight, second.nLastScanningErrorBlockHeight);
+        swap(first.nMessVersion, second.nMessVersion);
     }
 
     CMasternode& operator=(CMasternode from)
@@ -217,6 +238,8 @@ public:
         READWRITE(nLastDsq);
         READWRITE(nScanningErrorCount);
         READWRITE(nLastScanningErrorBlockHeight);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
     }
 
     int64_t SecondsSincePayment();
@@ -293,6 +316,9 @@ public:
 
 class CMasternodeBroadcast : public CMasternode
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     CMasternodeBroadcast();
     CMasternodeBroadcast(CService newAddr, CTxIn newVin, CPubKey newPubkey, CPubKey newPubkey2, int protocolVersionIn);
@@ -303,8 +329,11 @@ public:
     bool Sign(CKey& keyCollateralAddress);
     bool VerifySignature();
     void Relay();
-    std::string GetOldStrMessage();
-    std::string GetNewStrMessage();
+    std::string GetOldStrMessage() const;
+    std::string GetNewStrMessage() const;
+
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -320,6 +349,10 @@ public:
         READWRITE(protocolVersion);
         READWRITE(lastPing);
         READWRITE(nLastDsq);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 
     uint256 GetHash()
@@ -0,0 +1,59 @@
+// Copyright (c) 2018 The QBICcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodedb.h"
+#include "util.h"
+#include "utiltime.h"
+
+CMasternodeStateDB* pMasternodeStateDB = NULL;
+
+CMasternodeStateDB::CMasternodeStateDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "mnstate", nCacheSize, fMemory, fWipe)
+{
+    nLastCompact = GetTime();
+}
+
+bool CMasternodeStateDB::IsEmpty()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    pcursor->SeekToFirst();
+    return !pcursor->Valid();
+}
+
+void CMasternodeStateDB::MaybeCompact()
+{
+    if (GetTime() - nLastCompact < MASTERNODE_STATE_COMPACT_SECONDS)
+        return;
+
+    int64_t nStart = GetTimeMillis();
+    CompactFull();
+    nLastCompact = GetTime();
+    LogPrint("masternode", "CMasternodeStateDB::MaybeCompact - compacted in %dms\n", GetTimeMillis() - nStart);
+}
+
+CMasternodeStateSync::CMasternodeStateSync(CMasternodeStateDB& dbIn, char chTypeIn) : db(dbIn), lock(dbIn.cs, "db.cs", __FILE__, __LINE__), chType(chTypeIn), nWritten(0)
+{
+}
+
+bool CMasternodeStateSync::Commit()
+{
+    // The records of a type are stored next to each other, sorted by key
+    unsigned int nErased = 0;
+    std::map<std::string, uint256>::iterator it = db.mapStored.lower_bound(std::string(1, chType));
+    while (it != db.mapStored.end() && it->first[0] == chType) {
+        if (setSynced.count(it->first)) {
+            ++it;
+            continue;
+        }
+        batch.EraseSerialized(it->first);
+        db.mapStored.erase(it++);
+        nErased++;
+    }
+
+    LogPrint("masternode", "CMasternodeStateSync::Commit - type %c: %u records, %u written, %u erased\n", chType, setSynced.size(), nWritten, nErased);
+    setSynced.clear();
+    nWritten = 0;
+    bool fOk = db.WriteBatch(batch);
+    batch.Clear();
+    return fOk;
+}
@@ -0,0 +1,160 @@
+// Copyright (c) 2018 The QBICcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef QBICcoin_MASTERNODEDB_H
+#define QBICcoin_MASTERNODEDB_H
+
+#include "hash.h"
+#include "leveldbwrapper.h"
+#include "sync.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+/** Cache size of the masternode state database */
+static const size_t MASTERNODE_STATE_DB_CACHE = 2 << 20;
+/** Seconds between compactions of the masternode state database */
+static const int64_t MASTERNODE_STATE_COMPACT_SECONDS = 24 * 60 * 60;
+
+/**
+ * Masternode list, masternode payment votes and budgets (formerly mncache.dat,
+ * mnpayments.dat and budget.dat), one record per entry under a one character
+ * type prefix:
+ *
+ * - m, b, g: masternodes, seen masternode broadcasts and pings
+ * - u, v, e, d: masternode list requests and the obfuscation queue count
+ * - w, k: masternode payment votes and payees by block
+ * - p, f: budget proposals and finalized budgets, with their votes
+ * - o, q: orphan budget and finalized budget votes
+ */
+class CMasternodeStateDB : public CLevelDBWrapper
+{
+    friend class CMasternodeStateSync;
+
+public:
+    CMasternodeStateDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+private:
+    CMasternodeStateDB(const CMasternodeStateDB&);
+    void operator=(const CMasternodeStateDB&);
+
+    //! protects mapStored, syncs do not interleave
+    CCriticalSection cs;
+    //! hash of the stored value of every record, by serialized key
+    std::map<std::string, uint256> mapStored;
+    int64_t nLastCompact;
+
+public:
+    /** Call fn(key, value) for every record of type chType, returns false if one could not be read */
+    template <typename K, typename V, typename Callback>
+    bool LoadEntries(char chType, Callback fn)
+    {
+        LOCK(cs);
+        boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << chType;
+        pcursor->Seek(ssKeySet.str());
+
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey[0] != chType)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            K key;
+            V value;
+            try {
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chTypeIn;
+                ssKey >> chTypeIn >> key;
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            } catch (const std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+
+            mapStored[slKey.ToString()] = Hash(slValue.data(), slValue.data() + slValue.size());
+            fn(key, value);
+        }
+        return true;
+    }
+
+    /** Replace the records of type chType by the entries of mapEntries, see CMasternodeStateSync */
+    template <typename K, typename V>
+    bool WriteMap(char chType, const std::map<K, V>& mapEntries);
+
+    /** Add the records of type chType to mapEntries */
+    template <typename K, typename V>
+    bool ReadMap(char chType, std::map<K, V>& mapEntries)
+    {
+        return LoadEntries<K, V>(chType, [&mapEntries](const K& key, const V& value) {
+            mapEntries.insert(std::make_pair(key, value));
+        });
+    }
+
+    /** Whether nothing was stored yet */
+    bool IsEmpty();
+
+    /** Compact the database if it was not for MASTERNODE_STATE_COMPACT_SECONDS */
+    void MaybeCompact();
+};
+
+/**
+ * Writes the records of one type to a CMasternodeStateDB: only the ones whose
+ * serialized form changed since they were last stored, and erases the stored
+ * ones that were not written again. Keeps other syncs out while alive.
+ */
+class CMasternodeStateSync
+{
+private:
+    CMasternodeStateDB& db;
+    CCriticalBlock lock;
+    char chType;
+    std::set<std::string> setSynced;
+    CLevelDBBatch batch;
+    unsigned int nWritten;
+
+public:
+    CMasternodeStateSync(CMasternodeStateDB& dbIn, char chTypeIn);
+
+    template <typename K, typename V>
+    void Write(const K& key, const V& value)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << std::make_pair(chType, key);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << value;
+
+        std::string strKey = ssKey.str();
+        uint256 hash = Hash(ssValue.begin(), ssValue.end());
+        setSynced.insert(strKey);
+        std::map<std::string, uint256>::iterator it = db.mapStored.find(strKey);
+        if (it != db.mapStored.end() && it->second == hash)
+            return;
+
+        db.mapStored[strKey] = hash;
+        batch.WriteSerialized(strKey, ssValue);
+        nWritten++;
+    }
+
+    /** Erase what was not written again and write everything out */
+    bool Commit();
+};
+
+template <typename K, typename V>
+bool CMasternodeStateDB::WriteMap(char chType, const std::map<K, V>& mapEntries)
+{
+    CMasternodeStateSync sync(*this, chType);
+    for (typename std::map<K, V>::const_iterator it = mapEntries.begin(); it != mapEntries.end(); ++it)
+        sync.Write(it->first, it->second);
+    return sync.Commit();
+}
+
+extern CMasternodeStateDB* pMasternodeStateDB;
+
+#endif //QBICcoin_MASTERNODEDB_H
@@ -8,6 +8,7 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "masternode.h"
+#include "masternodedb.h"
 #include "obfuscation.h"
 #include "spork.h"
 #include "util.h"
@@ -53,39 +54,6 @@ CMasternodeDB::CMasternodeDB()
     strMagicMessage = "MasternodeCache";
 }
 
-bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
-{
-    int64_t nStart = GetTimeMillis();
-
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
-    ssMasternodes << strMagicMessage;                   // masternode cache file specific magic message
-    ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssMasternodes << mnodemanToSave;
-    uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    ssMasternodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssMasternodes;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    //    FileCommit(fileout);
-    fileout.fclose();
-
-    LogPrint("masternode","Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", mnodemanToSave.ToString());
-
-    return true;
-}
-
 CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
@@ -169,34 +137,51 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bo
 
 void DumpMasternodes()
 {
+    if (pMasternodeStateDB == NULL)
+        return;
+
     int64_t nStart = GetTimeMillis();
+    if (!mnodeman.WriteState(*pMasternodeStateDB))
+        LogPrintf("Error writing masternode state\n");
 
-    CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
-
-    LogPrint("masternode","Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodeDB::FileError)
-        LogPrint("masternode","Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrint("masternode","Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
+    LogPrint("masternode","Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
+}
+
+void LoadMasternodes(bool fImportCacheFile)
+{
+    if (fImportCacheFile) {
+        CMasternodeDB mndb;
+        CMasternodeDB::ReadResult readResult = mndb.Read(mnodeman);
+        if (readResult == CMasternodeDB::FileError)
+            LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
+        else if (readResult != CMasternodeDB::Ok) {
+            LogPrintf("Error reading mncache.dat: ");
+            if (readResult == CMasternodeDB::IncorrectFormat)
+                LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+            else
+                LogPrintf("file format is unknown or invalid, please fix it manually\n");
         }
+        return;
     }
-    LogPrint("masternode","Writting info to mncache.dat...\n");
-    mndb.Write(mnodeman);
 
-    LogPrint("masternode","Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
+    int64_t nStart = GetTimeMillis();
+    if (!mnodeman.ReadState(*pMasternodeStateDB)) {
+        LogPrintf("Error reading masternode state, will try to recreate\n");
+        return;
+    }
+
+    LogPrint("masternode","Loaded masternode state  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","  %s\n", mnodeman.ToString());
+    LogPrint("masternode","Masternode manager - cleaning....\n");
+    mnodeman.CheckAndRemove(true);
+    LogPrint("masternode","Masternode manager - result:\n");
+    LogPrint("masternode","  %s\n", mnodeman.ToString());
 }
 
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    nListVersion = 0;
 }
 
 bool CMasternodeMan::Add(CMasternode& mn)
@@ -210,6 +195,7 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        nListVersion++;
         return true;
     }
 
@@ -280,6 +266,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            nListVersion++;
         } else {
             ++it;
         }
@@ -341,6 +328,7 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    nListVersion++;
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -758,7 +746,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         }
 
         // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
+        //  - this is checked later by .check() in many places and by the masternode maintenance tasks
         if (mnb.CheckInputsAndAdd(nDoS)) {
             // use this as a peer
             addrman.Add(CAddress(mnb.addr), pfrom->addr, 2 * 60 * 60);
@@ -983,7 +971,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         LogPrint("masternode", "dsee - Got NEW OLD Masternode entry %s\n", vin.prevout.hash.ToString());
 
         // make sure it's still unspent
-        //  - this is checked later by .check() in many places and by ThreadCheckObfuScationPool()
+        //  - this is checked later by .check() in many places and by the masternode maintenance tasks
 
         CValidationState state;
         CMutableTransaction tx = CMutableTransaction();
@@ -1141,12 +1129,25 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            nListVersion++;
             break;
         }
         ++it;
     }
 }
 
+int CMasternodeMan::GetListVersion()
+{
+    LOCK(cs);
+    return nListVersion;
+}
+
+void CMasternodeMan::MasternodeKeyChanged()
+{
+    LOCK(cs);
+    nListVersion++;
+}
+
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
 {
 	mapSeenMasternodePing.insert(make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
@@ -1164,6 +1165,45 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
     }
 }
 
+bool CMasternodeMan::WriteState(CMasternodeStateDB& db)
+{
+    LOCK(cs);
+
+    CMasternodeStateSync syncMasternodes(db, 'm');
+    BOOST_FOREACH (const CMasternode& mn, vMasternodes)
+        syncMasternodes.Write(mn.vin.prevout, mn);
+
+    return syncMasternodes.Commit() &&
+           db.WriteMap('b', mapSeenMasternodeBroadcast) &&
+           db.WriteMap('g', mapSeenMasternodePing) &&
+           db.WriteMap('u', mAskedUsForMasternodeList) &&
+           db.WriteMap('v', mWeAskedForMasternodeList) &&
+           db.WriteMap('e', mWeAskedForMasternodeListEntry) &&
+           db.Write(make_pair('d', 0), nDsqCount);
+}
+
+bool CMasternodeMan::ReadState(CMasternodeStateDB& db)
+{
+    LOCK(cs);
+
+    nListVersion++;
+    bool fOk = db.LoadEntries<COutPoint, CMasternode>('m', [this](const COutPoint& outpoint, const CMasternode& mn) {
+                   vMasternodes.push_back(mn);
+               }) &&
+               db.ReadMap('b', mapSeenMasternodeBroadcast) &&
+               db.ReadMap('g', mapSeenMasternodePing) &&
+               db.ReadMap('u', mAskedUsForMasternodeList) &&
+               db.ReadMap('v', mWeAskedForMasternodeList) &&
+               db.ReadMap('e', mWeAskedForMasternodeListEntry);
+    if (!fOk) {
+        Clear();
+        return false;
+    }
+
+    db.Read(make_pair('d', 0), nDsqCount);
+    return true;
+}
+
 std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
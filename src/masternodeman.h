@@ -15,17 +15,21 @@
 #include "sync.h"
 #include "util.h"
 
-#define MASTERNODES_DUMP_SECONDS (15 * 60)
+#define MASTERNODES_DUMP_SECONDS (5 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
 
 using namespace std;
 
 class CMasternodeMan;
+class CMasternodeStateDB;
 
 extern CMasternodeMan mnodeman;
+/** Write the masternode list entries that changed to the masternode state database */
 void DumpMasternodes();
+/** Load the masternode list, from mncache.dat of older versions once if fImportCacheFile */
+void LoadMasternodes(bool fImportCacheFile);
 
-/** Access to the MN database (mncache.dat)
+/** Access to the MN cache file of older versions (mncache.dat)
  */
 class CMasternodeDB
 {
@@ -45,7 +49,6 @@ public:
     };
 
     CMasternodeDB();
-    bool Write(const CMasternodeMan& mnodemanToSave);
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
@@ -66,6 +69,8 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    // bumped whenever an entry is added, removed or changes its key
+    int nListVersion;
 
 public:
     // Keep track of all broadcasts I've seen
@@ -90,6 +95,8 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if (ser_action.ForRead())
+            nListVersion++;
     }
 
     CMasternodeMan();
@@ -156,8 +163,18 @@ public:
 
     int GetEstimatedMasternodes(int nBlock);
 
+    /// Version of the masternode list, changes whenever results looked up in it may have changed
+    int GetListVersion();
+    /// Note that an entry got a new masternode key
+    void MasternodeKeyChanged();
+
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
+
+    /// Store the entries that changed since the last call
+    bool WriteState(CMasternodeStateDB& db);
+    /// Load everything stored by WriteState
+    bool ReadState(CMasternodeStateDB& db);
 };
 
 #endif
@@ -192,9 +192,9 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         // This vector will be sorted into a priority queue:
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
+        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
              mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
+            const CTransaction& tx = mi->GetTx();
             if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
                 continue;
             }
@@ -204,98 +204,70 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
             COrphan* porphan = NULL;
             double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
             uint256 txid = tx.GetHash();
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to zpivs that have been in mempool long
-                    //and higher priority to zpivs that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
+            if (tx.IsZerocoinSpend()) {
+                //Give a high priority to zerocoinspends to get into the next block
+                //Priority = (age^6+100000)*amount - gives higher priority to zpivs that have been in mempool long
+                //and higher priority to zpivs that are large in value
+                CAmount nTotalIn = tx.GetZerocoinSpent();
+                int64_t nTimeSeen = GetAdjustedTime();
+                double nConfs = 100000;
+
+                auto it = mapZerocoinspends.find(txid);
+                if (it != mapZerocoinspends.end()) {
+                    nTimeSeen = it->second;
+                } else {
+                    //for some reason not in map, add it
+                    mapZerocoinspends[txid] = nTimeSeen;
+                }
 
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
+                double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
 
-                    // zQBIC spends can have very large priority, use non-overflowing safe functions
+                // zQBIC spends can have very large priority, use non-overflowing safe functions
+                for (unsigned int i = 0; i < tx.vin.size(); i++) {
                     dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
                     dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-                    continue;
                 }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
+                dPriority = tx.ComputePriority(dPriority, mi->GetTxSize());
+            } else {
+                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+                bool fInvalidInputs = false;
+                for (const CTxIn& txin : tx.vin) {
+                    if (invalid_out::ContainsOutPoint(txin.prevout)) {
+                        LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+                        fInvalidInputs = true;
                         break;
                     }
+                }
+                if (fInvalidInputs) continue;
 
-                    // Has to wait for dependencies
+                // Has to wait for the mempool transactions it spends
+                BOOST_FOREACH (CTxMemPool::txiter parent, mempool.GetMemPoolParents(mi)) {
+                    const uint256& hashParent = parent->GetTx().GetHash();
                     if (!porphan) {
                         // Use list for automatic deletion
                         vOrphan.push_back(COrphan(&tx));
                         porphan = &vOrphan.back();
                     }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
+                    mapDependers[hashParent].push_back(porphan);
+                    porphan->setDependsOn.insert(hashParent);
                 }
 
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (invalid_out::ContainsOutPoint(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zQBIC spends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
+                // Priority is sum(valuein * age) / modified_txsize, as of
+                // entering the pool plus the age gained since
+                dPriority = mi->GetPriority(nHeight);
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+            CAmount nFeeDummy = 0;
+            mempool.ApplyDeltas(txid, dPriority, nFeeDummy);
 
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
+            CFeeRate feeRate(mi->GetModifiedFee(), mi->GetTxSize());
 
             if (porphan) {
                 porphan->dPriority = dPriority;
                 porphan->feeRate = feeRate;
             } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->GetTx()));
         }
 
         // Collect transactions into block
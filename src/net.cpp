@@ -26,6 +26,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -683,6 +684,8 @@ void CNode::copyStats(CNodeStats& stats)
     X(nStartingHeight);
     X(nSendBytes);
     X(nRecvBytes);
+    X(nSendMsgs);
+    X(nSendSyscalls);
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -718,9 +721,11 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 
         // absorb network data
         int handled;
-        if (!msg.in_data)
+        if (!msg.in_data) {
             handled = msg.readHeader(pch, nBytes);
-        else
+            if (msg.in_data && msg.hdr.nMessageSize <= MAX_PROTOCOL_MESSAGE_LENGTH)
+                recvBufferPool.Take(std::min(msg.hdr.nMessageSize, RECV_BUFFER_STEP), msg.vRecv);
+        } else
             handled = msg.readData(pch, nBytes);
 
         if (handled < 0)
@@ -778,17 +783,111 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
+    if (vRecv.capacity() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        vRecv.reserve(std::min(hdr.nMessageSize, std::max((unsigned int)vRecv.capacity() * 2, nDataPos + nCopy + RECV_BUFFER_STEP)));
     }
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Append without zero-filling the buffer first, and hash the data while it is hot in cache
+    vRecv.write(pch, nCopy);
+    hasher.Write((const unsigned char*)pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+const uint256& CNetMessage::GetMessageHash() const
+{
+    assert(complete());
+    if (data_hash.IsNull())
+        hasher.Finalize(data_hash.begin());
+    return data_hash;
+}
+
+const unsigned int CRecvBufferPool::SIZE_CLASSES[CRecvBufferPool::NUM_SIZE_CLASSES] = {
+    4 * 1024, 64 * 1024, RECV_BUFFER_STEP, MAX_PROTOCOL_MESSAGE_LENGTH};
+
+bool CRecvBufferPool::Take(unsigned int nSize, CDataStream& vRecv)
+{
+    for (unsigned int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        if (SIZE_CLASSES[i] < nSize)
+            continue;
+        std::vector<CDataStream>& vClass = vBuffers[i];
+        for (std::vector<CDataStream>::iterator it = vClass.begin(); it != vClass.end(); ++it) {
+            if (it->capacity() < nSize)
+                continue;
+            int nType = vRecv.GetType();
+            int nVersion = vRecv.GetVersion();
+            nPooledBytes -= it->capacity();
+            vRecv.swap(*it);
+            vRecv.SetType(nType);
+            vRecv.SetVersion(nVersion);
+            vClass.erase(it);
+            nHits++;
+            return true;
+        }
+    }
+    nMisses++;
+    return false;
+}
+
+void CRecvBufferPool::Give(CDataStream& vRecv, size_t nMaxPooledBytes)
+{
+    vRecv.Compact();
+    size_t nCapacity = vRecv.capacity();
+    if (nCapacity == 0 || nPooledBytes + nCapacity > nMaxPooledBytes)
+        return;
+    for (unsigned int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        if (nCapacity > SIZE_CLASSES[i])
+            continue;
+        if (vBuffers[i].size() >= MAX_BUFFERS_PER_CLASS)
+            return;
+        vBuffers[i].push_back(CDataStream(vRecv.GetType(), vRecv.GetVersion()));
+        vBuffers[i].back().swap(vRecv);
+        vBuffers[i].back().clear();
+        nPooledBytes += nCapacity;
+        return;
+    }
+}
+
+void CNode::RecycleRecvMsg(CNetMessage& msg)
+{
+    // Never let pooled buffers take more than half of the receive flood allowance
+    recvBufferPool.Give(msg.vRecv, ReceiveFloodSize() / 2);
+}
+
+
+/**
+ * Write as many queued messages as fit into one batch with a single syscall,
+ * starting at message it. Returns the result of the syscall and the number of
+ * bytes that were offered in nBatchBytes.
+ */
+static int SendBatch(CNode* pnode, std::deque<CSerializeData>::iterator it, size_t& nBatchBytes)
+{
+#ifdef WIN32
+    const CSerializeData& data = *it;
+    nBatchBytes = data.size() - pnode->nSendOffset;
+    return send(pnode->hSocket, &data[pnode->nSendOffset], nBatchBytes, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_BATCH_MESSAGES];
+    int nIov = 0;
+    nBatchBytes = 0;
+    for (; it != pnode->vSendMsg.end() && nIov < MAX_SEND_BATCH_MESSAGES && nBatchBytes < MAX_SEND_BATCH_BYTES; ++it) {
+        size_t nOffset = (nIov == 0) ? pnode->nSendOffset : 0;
+        assert(it->size() > nOffset);
+        iov[nIov].iov_base = &(*it)[nOffset];
+        iov[nIov].iov_len = it->size() - nOffset;
+        nBatchBytes += iov[nIov].iov_len;
+        nIov++;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
 
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
@@ -796,20 +895,33 @@ void SocketSendData(CNode* pnode)
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nBatchBytes = 0;
+        int nBytes = SendBatch(pnode, it, nBatchBytes);
+        pnode->nSendSyscalls++;
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+
+            // Walk over the messages the batch covered
+            size_t nRemaining = nBytes;
+            while (nRemaining > 0) {
+                CSerializeData& data = *it;
+                size_t nLeft = data.size() - pnode->nSendOffset;
+                if (nRemaining < nLeft) {
+                    pnode->nSendOffset += nRemaining;
+                    break;
+                }
+                nRemaining -= nLeft;
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
+                pnode->nSendMsgs++;
+                pnode->RecycleSendBuffer(data);
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+
+            if ((size_t)nBytes < nBatchBytes) {
+                // could not send the full batch; stop sending more
                 break;
             }
         } else {
@@ -1538,8 +1650,16 @@ void ThreadMessageHandler()
             // Send messages
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
+                    // Cork the socket while SendMessages queues up pings, addr, inv and getdata
+                    // messages, then write them out together instead of one syscall per message
+                    bool fWasEmpty = pnode->vSendMsg.empty();
+                    pnode->fSendCorked = true;
                     g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
+                    pnode->fSendCorked = false;
+                    if (fWasEmpty && !pnode->vSendMsg.empty())
+                        SocketSendData(pnode);
+                }
             }
             boost::this_thread::interruption_point();
         }
@@ -1556,6 +1676,90 @@ void ThreadMessageHandler()
     }
 }
 
+//
+// Asynchronous message handling
+//
+// Message classes that don't need cs_main ordering against block and inventory
+// processing (masternode, budget, payment and SwiftX messages) are handed off by
+// ProcessMessage to a small pool of worker threads. Every peer is pinned to one
+// worker, which keeps the messages of a peer in the order they were received.
+//
+namespace
+{
+struct CAsyncMessage {
+    CNode* pnode;
+    std::string strCommand;
+    CDataStream vRecv;
+
+    CAsyncMessage(CNode* pnodeIn, const std::string& strCommandIn) : pnode(pnodeIn), strCommand(strCommandIn), vRecv(SER_NETWORK, PROTOCOL_VERSION) {}
+};
+
+class CAsyncMessageQueue
+{
+public:
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condSpace;
+    std::deque<CAsyncMessage*> queue;
+    uint64_t nProcessed;
+
+    CAsyncMessageQueue() : nProcessed(0) {}
+};
+}
+
+static std::vector<CAsyncMessageQueue*> vAsyncMessageQueues;
+
+bool QueueAsyncMessage(CNode* pnode, const std::string& strCommand, CDataStream& vRecv)
+{
+    if (vAsyncMessageQueues.empty())
+        return false;
+
+    CAsyncMessage* pmsg = new CAsyncMessage(pnode, strCommand);
+    pmsg->vRecv.swap(vRecv);
+    {
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+
+    CAsyncMessageQueue& q = *vAsyncMessageQueues[pnode->id % vAsyncMessageQueues.size()];
+    boost::unique_lock<boost::mutex> lock(q.mutex);
+    // Apply back pressure rather than buffering an unbounded number of messages
+    while (q.queue.size() >= MAX_ASYNC_MESSAGE_QUEUE)
+        q.condSpace.wait(lock);
+    q.queue.push_back(pmsg);
+    q.condWork.notify_one();
+    return true;
+}
+
+void static ThreadAsyncMessageHandler(CAsyncMessageQueue* pqueue)
+{
+    CAsyncMessageQueue& q = *pqueue;
+    while (true) {
+        CAsyncMessage* pmsg = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            while (q.queue.empty())
+                q.condWork.wait(lock);
+            pmsg = q.queue.front();
+            q.queue.pop_front();
+            q.condSpace.notify_all();
+        }
+
+        if (!pmsg->pnode->fDisconnect)
+            g_signals.ProcessAsyncMessage(pmsg->pnode, pmsg->strCommand, pmsg->vRecv);
+
+        {
+            LOCK(cs_vNodes);
+            pmsg->pnode->Release();
+        }
+
+        if (++q.nProcessed % 10000 == 0)
+            LogPrint("net", "%s : %d messages processed\n", __func__, q.nProcessed);
+        delete pmsg;
+        boost::this_thread::interruption_point();
+    }
+}
+
 // ppcoin: stake minter thread
 void static ThreadStakeMinter()
 {
@@ -1765,6 +1969,16 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate outbound connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
+    // Process masternode, budget and SwiftX messages off the message handler thread
+    int nAsyncThreads = std::max(0, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS), MAX_MSGHANDLER_THREADS));
+    if (vAsyncMessageQueues.empty()) {
+        for (int i = 0; i < nAsyncThreads; i++)
+            vAsyncMessageQueues.push_back(new CAsyncMessageQueue());
+    }
+    LogPrintf("Using %u asynchronous message handler threads\n", vAsyncMessageQueues.size());
+    BOOST_FOREACH (CAsyncMessageQueue* pqueue, vAsyncMessageQueues)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msgasync", boost::function<void()>(boost::bind(&ThreadAsyncMessageHandler, pqueue))));
+
     // Process messages
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
@@ -1816,6 +2030,12 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+        BOOST_FOREACH (CAsyncMessageQueue* pqueue, vAsyncMessageQueues) {
+            BOOST_FOREACH (CAsyncMessage* pmsg, pqueue->queue)
+                delete pmsg;
+            delete pqueue;
+        }
+        vAsyncMessageQueues.clear();
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2076,6 +2296,9 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendMsgs = 0;
+    nSendSyscalls = 0;
+    fSendCorked = false;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
@@ -2194,11 +2417,15 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+    if (!vSendBufferPool.empty()) {
+        (*it).swap(vSendBufferPool.back());
+        vSendBufferPool.pop_back();
+    }
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (it == vSendMsg.begin() && !fSendCorked)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
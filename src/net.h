@@ -52,6 +52,16 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** Step by which receive buffers grow while a message arrives */
+static const unsigned int RECV_BUFFER_STEP = 256 * 1024;
+/** Maximum number of queued messages written by a single send syscall */
+static const int MAX_SEND_BATCH_MESSAGES = 64;
+/** Maximum number of bytes written by a single send syscall */
+static const size_t MAX_SEND_BATCH_BYTES = 256 * 1024;
+/** Maximum number of serialization buffers kept per connection for reuse */
+static const size_t MAX_SEND_BUFFER_POOL = 16;
+/** Serialization buffers larger than this are freed instead of reused */
+static const size_t MAX_POOLED_SEND_BUFFER = 64 * 1024;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -62,6 +72,12 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** -msghandlerthreads default (0 = handle every message on the message handler thread) */
+static const int DEFAULT_MSGHANDLER_THREADS = 2;
+/** Maximum number of asynchronous message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** Maximum number of messages waiting in one asynchronous queue before the message handler blocks */
+static const size_t MAX_ASYNC_MESSAGE_QUEUE = 2500;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -81,6 +97,13 @@ bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
+/**
+ * Hand a message off to the asynchronous message handler threads. Messages from
+ * the same peer always land on the same thread, so they are processed in the order
+ * they were received. The content of vRecv is moved into the queue.
+ * Returns false if asynchronous message handling is disabled.
+ */
+bool QueueAsyncMessage(CNode* pnode, const std::string& strCommand, CDataStream& vRecv);
 
 typedef int NodeId;
 
@@ -88,6 +111,7 @@ typedef int NodeId;
 struct CNodeSignals {
     boost::signals2::signal<int()> GetHeight;
     boost::signals2::signal<bool(CNode*)> ProcessMessages;
+    boost::signals2::signal<void(CNode*, std::string&, CDataStream&)> ProcessAsyncMessage;
     boost::signals2::signal<bool(CNode*, bool)> SendMessages;
     boost::signals2::signal<void(NodeId, const CNode*)> InitializeNode;
     boost::signals2::signal<void(NodeId)> FinalizeNode;
@@ -167,6 +191,8 @@ public:
     int nStartingHeight;
     uint64_t nSendBytes;
     uint64_t nRecvBytes;
+    uint64_t nSendMsgs;
+    uint64_t nSendSyscalls;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -176,6 +202,10 @@ public:
 
 class CNetMessage
 {
+private:
+    mutable CHash256 hasher;
+    mutable uint256 data_hash;
+
 public:
     bool in_data; // parsing header (false) or data (true)
 
@@ -188,6 +218,8 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    bool fSignaturesChecked; // already looked at by CheckMasternodeMessageSignatures
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
     {
         hdrbuf.resize(24);
@@ -195,6 +227,7 @@ public:
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fSignaturesChecked = false;
     }
 
     bool complete() const
@@ -204,6 +237,9 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    /** Double-SHA256 of the message data, computed while the data was received. Requires complete(). */
+    const uint256& GetMessageHash() const;
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -215,6 +251,39 @@ public:
 };
 
 
+/**
+ * Per-connection pool of receive buffers, bucketed by capacity. The buffers of
+ * processed messages are handed back to the pool, so the next message of a
+ * similar size reuses the allocation instead of growing a fresh buffer.
+ */
+class CRecvBufferPool
+{
+public:
+    /** Upper capacity bound of every size class */
+    static const unsigned int SIZE_CLASSES[];
+    static const unsigned int NUM_SIZE_CLASSES = 4;
+    /** Maximum number of buffers kept per size class */
+    static const unsigned int MAX_BUFFERS_PER_CLASS = 4;
+
+    CRecvBufferPool() : nPooledBytes(0), nHits(0), nMisses(0) {}
+
+    /** Move a pooled buffer able to hold nSize bytes into vRecv. Returns false if there is none. */
+    bool Take(unsigned int nSize, CDataStream& vRecv);
+    /** Return the buffer of vRecv to the pool, as long as the pool stays under nMaxPooledBytes */
+    void Give(CDataStream& vRecv, size_t nMaxPooledBytes);
+
+    size_t GetPooledBytes() const { return nPooledBytes; }
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+
+private:
+    std::vector<CDataStream> vBuffers[NUM_SIZE_CLASSES];
+    size_t nPooledBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+};
+
+
 typedef enum BanReason
 {
     BanReasonUnknown          = 0,
@@ -288,11 +357,16 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
+    uint64_t nSendMsgs;     // number of messages written to the socket
+    uint64_t nSendSyscalls; // number of send syscalls used to write them
+    bool fSendCorked;       // hold back the optimistic write while a batch of messages is queued
     std::deque<CSerializeData> vSendMsg;
+    std::vector<CSerializeData> vSendBufferPool; // sent message buffers kept for reuse
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
+    CRecvBufferPool recvBufferPool;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
@@ -406,15 +480,18 @@ public:
     // requires LOCK(cs_vRecvMsg)
     unsigned int GetTotalRecvSize()
     {
-        unsigned int total = 0;
+        unsigned int total = recvBufferPool.GetPooledBytes();
         BOOST_FOREACH (const CNetMessage& msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += msg.vRecv.capacity() + 24;
         return total;
     }
 
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char* pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    void RecycleRecvMsg(CNetMessage& msg);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -423,6 +500,16 @@ public:
             msg.SetVersion(nVersionIn);
     }
 
+    // requires LOCK(cs_vSend)
+    void RecycleSendBuffer(CSerializeData& data)
+    {
+        if (vSendBufferPool.size() >= MAX_SEND_BUFFER_POOL || data.capacity() > MAX_POOLED_SEND_BUFFER)
+            return;
+        data.clear();
+        vSendBufferPool.push_back(CSerializeData());
+        vSendBufferPool.back().swap(data);
+    }
+
     CNode* AddRef()
     {
         nRefCount++;
@@ -5,14 +5,21 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "obfuscation.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
+#include "crypto/sha256.h"
 #include "init.h"
 #include "main.h"
+#include "masternode-budget.h"
+#include "masternode-payments.h"
+#include "masternodedb.h"
 #include "masternodeman.h"
+#include "scheduler.h"
 #include "script/sign.h"
 #include "swifttx.h"
 #include "ui_interface.h"
 #include "util.h"
+#include "validationinterface.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -2150,12 +2157,26 @@ bool CObfuScationSigner::GetKeysFromSecret(std::string strSecret, CKey& keyRet,
 }
 
 bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorMessage, vector<unsigned char>& vchSig, CKey key)
+{
+    return SignHash(GetMessageHash(strMessage), errorMessage, vchSig, key);
+}
+
+bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+{
+    return VerifyHash(pubkey, vchSig, GetMessageHash(strMessage), errorMessage);
+}
+
+uint256 CObfuScationSigner::GetMessageHash(const std::string& strMessage) const
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    return ss.GetHash();
+}
 
-    if (!key.SignCompact(ss.GetHash(), vchSig)) {
+bool CObfuScationSigner::SignHash(const uint256& hash, std::string& errorMessage, vector<unsigned char>& vchSig, const CKey& key)
+{
+    if (!key.SignCompact(hash, vchSig)) {
         errorMessage = _("Signing failed.");
         return false;
     }
@@ -2163,22 +2184,173 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
     return true;
 }
 
-bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+bool CObfuScationSigner::VerifyHash(const CPubKey& pubkey, const vector<unsigned char>& vchSig, const uint256& hash, std::string& errorMessage)
 {
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << strMessageMagic;
-    ss << strMessage;
+    {
+        // Checked ahead by CheckMasternodeMessageSignatures, every entry is used once
+        LOCK(cs_verified);
+        if (!setVerified.empty() && setVerified.erase(GetVerifiedEntry(pubkey, vchSig, hash)))
+            return true;
+    }
 
-    CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
-        errorMessage = _("Error recovering public key.");
+    // Checking the signature against the key we expect is cheaper than
+    // recovering the key from the signature and comparing
+    if (!pubkey.VerifyCompact(hash, vchSig)) {
+        errorMessage = _("Error verifying signature.");
         return false;
     }
 
-    if (fDebug && pubkey2.GetID() != pubkey.GetID())
-        LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
+    return true;
+}
+
+int CObfuScationSigner::GetMessageVersion() const
+{
+    return IsSporkActive(SPORK_17_MESSAGE_DIGEST_SIGNATURES) ? MESS_VER_HASH : MESS_VER_STRMESS;
+}
 
-    return (pubkey2.GetID() == pubkey.GetID());
+uint256 CObfuScationSigner::GetVerifiedEntry(const CPubKey& pubkey, const vector<unsigned char>& vchSig, const uint256& hash)
+{
+    uint256 entry;
+    CSHA256().Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    return entry;
+}
+
+void CObfuScationSigner::AddVerifiedSignature(const CPubKey& pubkey, const vector<unsigned char>& vchSig, const uint256& hash)
+{
+    uint256 entry = GetVerifiedEntry(pubkey, vchSig, hash);
+    LOCK(cs_verified);
+    setVerified.insert(entry);
+}
+
+void CObfuScationSigner::TrimVerifiedSignatures()
+{
+    // Messages dropped before their signature was verified leave their entry
+    // behind; a few batches worth is plenty for anything still queued
+    LOCK(cs_verified);
+    if (setVerified.size() > 4 * MAX_MESSAGE_SIGNATURE_BATCH)
+        setVerified.clear();
+}
+
+bool CMessageSignatureCheck::operator()()
+{
+    if (pubkey.VerifyCompact(hash, vchSig))
+        obfuScationSigner.AddVerifiedSignature(pubkey, vchSig, hash);
+    return true;
+}
+
+static CCheckQueue<CMessageSignatureCheck> messagecheckqueue(32);
+
+void ThreadMessageSignatureCheck()
+{
+    RenameThread("qbiccoin-mnsigs");
+    messagecheckqueue.Thread();
+}
+
+static bool IsMasternodeSignedCommand(const std::string& strCommand)
+{
+    return strCommand == "mnb" || strCommand == "mnp" || strCommand == "mnw" ||
+           strCommand == "mvote" || strCommand == "fbvote" || strCommand == "txlvote";
+}
+
+/** The masternode key a message from vin is signed with, looking at broadcasts earlier in the batch too */
+static bool GetBatchMasternodeKey(const CTxIn& vin, const std::map<COutPoint, CPubKey>& mapBatchKeys, CPubKey& pubkeyRet)
+{
+    CMasternode* pmn = mnodeman.Find(vin);
+    if (pmn != NULL) {
+        pubkeyRet = pmn->pubKeyMasternode;
+        return true;
+    }
+    std::map<COutPoint, CPubKey>::const_iterator it = mapBatchKeys.find(vin.prevout);
+    if (it == mapBatchKeys.end())
+        return false;
+    pubkeyRet = it->second;
+    return true;
+}
+
+void CheckMasternodeMessageSignatures(CNode* pfrom)
+{
+    // The check threads are started next to the script check threads
+    if (fLiteMode || nScriptCheckThreads == 0)
+        return;
+
+    // Only start a batch when the handler is about to run into a signed message
+    std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
+    if (it == pfrom->vRecvMsg.end() || !it->complete() || it->fSignaturesChecked ||
+        !IsMasternodeSignedCommand(it->hdr.GetCommand()))
+        return;
+
+    obfuScationSigner.TrimVerifiedSignatures();
+
+    std::vector<CMessageSignatureCheck> vChecks;
+    std::map<COutPoint, CPubKey> mapBatchKeys;
+    unsigned int nMessages = 0;
+    for (; it != pfrom->vRecvMsg.end() && it->complete() && nMessages < MAX_MESSAGE_SIGNATURE_BATCH; ++it) {
+        CNetMessage& msg = *it;
+        if (msg.fSignaturesChecked)
+            continue;
+        msg.fSignaturesChecked = true;
+
+        std::string strCommand = msg.hdr.GetCommand();
+        if (!IsMasternodeSignedCommand(strCommand))
+            continue;
+        nMessages++;
+
+        // Work on a copy, the handler reads the message itself later on. Messages
+        // already seen are skipped, their handlers return before verifying.
+        CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), msg.vRecv.GetType(), msg.vRecv.GetVersion());
+        CPubKey pubkey;
+        try {
+            if (strCommand == "mnb") {
+                CMasternodeBroadcast mnb;
+                vRecv >> mnb;
+                if (mnodeman.mapSeenMasternodeBroadcast.count(mnb.GetHash()))
+                    continue;
+                vChecks.push_back(CMessageSignatureCheck(mnb.pubKeyCollateralAddress, mnb.sig, mnb.GetSignatureHash()));
+                if (mnb.lastPing != CMasternodePing()) {
+                    if (!GetBatchMasternodeKey(mnb.vin, mapBatchKeys, pubkey))
+                        pubkey = mnb.pubKeyMasternode;
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, mnb.lastPing.vchSig, mnb.lastPing.GetSignatureHash()));
+                }
+                mapBatchKeys[mnb.vin.prevout] = mnb.pubKeyMasternode;
+            } else if (strCommand == "mnp") {
+                CMasternodePing mnp;
+                vRecv >> mnp;
+                if (!mnodeman.mapSeenMasternodePing.count(mnp.GetHash()) && GetBatchMasternodeKey(mnp.vin, mapBatchKeys, pubkey))
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, mnp.vchSig, mnp.GetSignatureHash()));
+            } else if (strCommand == "mnw") {
+                CMasternodePaymentWinner winner;
+                vRecv >> winner;
+                if (!masternodePayments.mapMasternodePayeeVotes.count(winner.GetHash()) && GetBatchMasternodeKey(winner.vinMasternode, mapBatchKeys, pubkey))
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, winner.vchSig, winner.GetSignatureHash()));
+            } else if (strCommand == "mvote") {
+                CBudgetVote vote;
+                vRecv >> vote;
+                if (!budget.mapSeenMasternodeBudgetVotes.count(vote.GetHash()) && GetBatchMasternodeKey(vote.vin, mapBatchKeys, pubkey))
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, vote.vchSig, vote.GetSignatureHash()));
+            } else if (strCommand == "fbvote") {
+                CFinalizedBudgetVote vote;
+                vRecv >> vote;
+                if (!budget.mapSeenFinalizedBudgetVotes.count(vote.GetHash()) && GetBatchMasternodeKey(vote.vin, mapBatchKeys, pubkey))
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, vote.vchSig, vote.GetSignatureHash()));
+            } else if (strCommand == "txlvote") {
+                CConsensusVote ctx;
+                vRecv >> ctx;
+                if (!mapTxLockVote.count(ctx.GetHash()) && GetBatchMasternodeKey(ctx.vinMasternode, mapBatchKeys, pubkey))
+                    vChecks.push_back(CMessageSignatureCheck(pubkey, ctx.vchMasterNodeSignature, ctx.GetSignatureHash()));
+            }
+        } catch (const std::exception&) {
+            // Malformed messages are rejected by their handler
+        }
+    }
+
+    // A lone signature is cheaper to check inline than to hand over
+    if (vChecks.size() < 2)
+        return;
+
+    LogPrint("masternode", "CheckMasternodeMessageSignatures - %u signatures from %u messages, peer=%d\n", vChecks.size(), nMessages, pfrom->id);
+    CCheckQueueControl<CMessageSignatureCheck> control(&messagecheckqueue);
+    control.Add(vChecks);
+    control.Wait();
 }
 
 bool CObfuscationQueue::Sign()
@@ -2281,45 +2453,224 @@ void CObfuscationPool::RelayCompletedTransaction(const int sessionID, const bool
         pnode->PushMessage("dsc", sessionID, error, errorID);
 }
 
-//TODO: Rename/move to core
-void ThreadCheckObfuScationPool()
+/**
+ * Masternode, budget and obfuscation maintenance, run by the scheduler thread so
+ * the tasks never run concurrently. The periodic ones reschedule themselves, the
+ * others are queued by new tips, new peers and processed obfuscation messages.
+ */
+class CMasternodeMaintenance : public CValidationInterface
 {
-    if (fLiteMode) return; //disable all Obfuscation/Masternode related functionality
+public:
+    enum Task {
+        TASK_SYNC,     //! masternode sync steps
+        TASK_STATUS,   //! activate and ping our masternode
+        TASK_LIST,     //! expire masternodes, connections and transaction locks
+        TASK_PAYMENTS, //! prune payment votes, on new tips
+        TASK_DUMP,     //! flush state to the masternode state database
+        TASK_POOL,     //! obfuscation session timeouts and denomination
+        TASK_COUNT
+    };
+
+    CMasternodeMaintenance();
+
+    void Start(CScheduler& scheduler);
+    void Stop();
+
+    /** Queue task to run once as soon as possible, unless it is queued or ran in the last nMinSeconds */
+    void Trigger(Task task, int64_t nMinSeconds = 0);
+
+    void InitializeNode(NodeId nodeid, const CNode* pnode);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+    void ProcessedMasternodeMessage(const std::string& strCommand);
+
+private:
+    struct TaskStats {
+        const char* pszName;
+        bool fQueued;
+        int nRuns;
+        int64_t nTimeTotal;
+        int64_t nTimeMax;
+        int64_t nLastRun;
+    };
+
+    //! protects pscheduler and vStats
+    CCriticalSection cs;
+    CScheduler* pscheduler;
+    TaskStats vStats[TASK_COUNT];
+    int64_t nLastDenominate;
+
+    /** Do the work of task, returns the seconds until its next periodic run */
+    int Execute(Task task);
+    void Run(Task task, bool fTriggered);
+};
+
+static CMasternodeMaintenance masternodeMaintenance;
+
+CMasternodeMaintenance::CMasternodeMaintenance() : pscheduler(NULL), nLastDenominate(0)
+{
+    static const char* const pszTaskNames[TASK_COUNT] = {"sync", "status", "list", "payments", "dump", "pool"};
+    for (int i = 0; i < TASK_COUNT; i++) {
+        vStats[i].pszName = pszTaskNames[i];
+        vStats[i].fQueued = false;
+        vStats[i].nRuns = 0;
+        vStats[i].nTimeTotal = 0;
+        vStats[i].nTimeMax = 0;
+        vStats[i].nLastRun = 0;
+    }
+}
 
-    // Make this thread recognisable as the wallet flushing thread
-    RenameThread("qbiccoin-obfuscation");
+void CMasternodeMaintenance::Start(CScheduler& scheduler)
+{
+    {
+        LOCK(cs);
+        pscheduler = &scheduler;
+    }
+    RegisterValidationInterface(this);
+    GetNodeSignals().InitializeNode.connect(boost::bind(&CMasternodeMaintenance::InitializeNode, this, _1, _2));
 
-    unsigned int c = 0;
+    scheduler.scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, TASK_SYNC, false), 1);
+    scheduler.scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, TASK_STATUS, false), 1);
+    scheduler.scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, TASK_LIST, false), MASTERNODE_LIST_CHECK_SECONDS);
+    scheduler.scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, TASK_DUMP, false), MASTERNODES_DUMP_SECONDS);
+    scheduler.scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, TASK_POOL, false), 1);
+}
 
-    while (true) {
-        MilliSleep(1000);
-        //LogPrintf("ThreadCheckObfuScationPool::check timeout\n");
+void CMasternodeMaintenance::Stop()
+{
+    GetNodeSignals().InitializeNode.disconnect(boost::bind(&CMasternodeMaintenance::InitializeNode, this, _1, _2));
+    UnregisterValidationInterface(this);
+
+    LOCK(cs);
+    pscheduler = NULL;
+}
+
+void CMasternodeMaintenance::Trigger(Task task, int64_t nMinSeconds)
+{
+    LOCK(cs);
+    TaskStats& stats = vStats[task];
+    if (pscheduler == NULL || stats.fQueued || GetTime() - stats.nLastRun < nMinSeconds)
+        return;
+
+    stats.fQueued = true;
+    pscheduler->scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, task, true), 0);
+}
+
+void CMasternodeMaintenance::InitializeNode(NodeId nodeid, const CNode* pnode)
+{
+    // the sync asks one more peer per step, don't wait for the next one
+    if (!masternodeSync.IsSynced())
+        Trigger(TASK_SYNC, MASTERNODE_SYNC_TIMEOUT);
+}
 
+void CMasternodeMaintenance::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    Trigger(TASK_PAYMENTS);
+    if (!masternodeSync.IsSynced())
+        Trigger(TASK_SYNC, MASTERNODE_SYNC_TIMEOUT);
+}
+
+void CMasternodeMaintenance::ProcessedMasternodeMessage(const std::string& strCommand)
+{
+    if (!fMasterNode && !fEnableZeromint)
+        return;
+
+    // sessions move on with these, act on the new state right away
+    if (strCommand == "dsa" || strCommand == "dsq" || strCommand == "dsi" || strCommand == "dssu" ||
+        strCommand == "dss" || strCommand == "dsf" || strCommand == "dsc")
+        Trigger(TASK_POOL);
+}
+
+int CMasternodeMaintenance::Execute(Task task)
+{
+    switch (task) {
+    case TASK_SYNC:
         // try to sync from all available nodes, one step at a time
         masternodeSync.Process();
+        return masternodeSync.IsSynced() ? MASTERNODE_SYNC_IDLE_SECONDS : MASTERNODE_SYNC_TIMEOUT;
 
-        if (masternodeSync.IsBlockchainSynced()) {
-            c++;
+    case TASK_STATUS:
+        // check if we should activate or ping every few minutes,
+        // start right after sync is considered to be done
+        if (!masternodeSync.IsBlockchainSynced())
+            return MASTERNODE_SYNC_TIMEOUT;
+        activeMasternode.ManageStatus();
+        return MASTERNODE_PING_SECONDS;
 
-            // check if we should activate or ping every few minutes,
-            // start right after sync is considered to be done
-            if (c % MASTERNODE_PING_SECONDS == 1) activeMasternode.ManageStatus();
+    case TASK_LIST:
+        if (masternodeSync.IsBlockchainSynced()) {
+            mnodeman.CheckAndRemove();
+            mnodeman.ProcessMasternodeConnections();
+            CleanTransactionLocksList();
+        }
+        return MASTERNODE_LIST_CHECK_SECONDS;
 
-            if (c % 60 == 0) {
-                mnodeman.CheckAndRemove();
-                mnodeman.ProcessMasternodeConnections();
-                masternodePayments.CleanPaymentList();
-                CleanTransactionLocksList();
-            }
+    case TASK_PAYMENTS:
+        if (masternodeSync.IsBlockchainSynced())
+            masternodePayments.CleanPaymentList();
+        return 0;
 
-            //if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
+    case TASK_DUMP:
+        if (masternodeSync.IsBlockchainSynced() && pMasternodeStateDB != NULL) {
+            DumpMasternodes();
+            DumpMasternodePayments();
+            DumpBudgets();
+            pMasternodeStateDB->MaybeCompact();
+        }
+        return MASTERNODES_DUMP_SECONDS;
 
+    case TASK_POOL:
+        if (masternodeSync.IsBlockchainSynced()) {
             obfuScationPool.CheckTimeout();
             obfuScationPool.CheckForCompleteQueue();
 
-            if (obfuScationPool.GetState() == POOL_STATUS_IDLE && c % 15 == 0) {
+            if (obfuScationPool.GetState() == POOL_STATUS_IDLE && GetTime() - nLastDenominate >= OBFUSCATION_DENOMINATE_SECONDS) {
+                nLastDenominate = GetTime();
                 obfuScationPool.DoAutomaticDenominating();
             }
         }
+        // sessions time out within seconds, only watch them closely when we take part
+        return (fMasterNode || fEnableZeromint) ? 1 : OBFUSCATION_DENOMINATE_SECONDS;
+
+    default:
+        return 0;
     }
 }
+
+void CMasternodeMaintenance::Run(Task task, bool fTriggered)
+{
+    if (fTriggered) {
+        LOCK(cs);
+        vStats[task].fQueued = false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int nNextRun = Execute(task);
+    int64_t nTime = GetTimeMicros() - nStart;
+
+    LOCK(cs);
+    TaskStats& stats = vStats[task];
+    stats.nRuns++;
+    stats.nTimeTotal += nTime;
+    stats.nTimeMax = std::max(stats.nTimeMax, nTime);
+    stats.nLastRun = GetTime();
+    LogPrint("bench", "  - Masternode maintenance %s%s: %.2fms [%.2fs (%d runs, max %.2fms)]\n", stats.pszName, fTriggered ? " (triggered)" : "",
+        nTime * 0.001, stats.nTimeTotal * 0.000001, stats.nRuns, stats.nTimeMax * 0.001);
+
+    // triggered runs come on top of the periodic ones
+    if (!fTriggered && nNextRun > 0 && pscheduler != NULL)
+        pscheduler->scheduleFromNow(boost::bind(&CMasternodeMaintenance::Run, this, task, false), nNextRun);
+}
+
+void StartMasternodeMaintenance(CScheduler& scheduler)
+{
+    if (fLiteMode) return; //disable all Obfuscation/Masternode related functionality
+
+    masternodeMaintenance.Start(scheduler);
+}
+
+void StopMasternodeMaintenance()
+{
+    masternodeMaintenance.Stop();
+}
@@ -22,6 +22,7 @@ class CBitcoinAddress;
 class CObfuscationQueue;
 class CObfuscationBroadcastTx;
 class CActiveMasternode;
+class CScheduler;
 
 // pool states for mixing
 #define POOL_STATUS_UNKNOWN 0              // waiting for update
@@ -50,6 +51,15 @@ class CActiveMasternode;
 static const CAmount OBFUSCATION_COLLATERAL = (10 * COIN);
 static const CAmount OBFUSCATION_POOL_MAX = (99999.99 * COIN);
 
+/** Maximum number of queued masternode messages whose signatures are checked together */
+static const unsigned int MAX_MESSAGE_SIGNATURE_BATCH = 256;
+/** Seconds between masternode sync steps once synced, to notice a lost masternode list */
+static const int MASTERNODE_SYNC_IDLE_SECONDS = 60;
+/** Seconds between checks of the masternode list, its connections and transaction locks */
+static const int MASTERNODE_LIST_CHECK_SECONDS = 60;
+/** Seconds between automatic denomination attempts */
+static const int OBFUSCATION_DENOMINATE_SECONDS = 15;
+
 extern CObfuscationPool obfuScationPool;
 extern CObfuScationSigner obfuScationSigner;
 extern std::vector<CObfuscationQueue> vecObfuscationQueue;
@@ -245,8 +255,38 @@ public:
 
 /** Helper object for signing and checking signatures
  */
+/** A masternode message signature checked ahead of its handler by the signature check threads */
+class CMessageSignatureCheck
+{
+private:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash;
+
+public:
+    CMessageSignatureCheck() {}
+    CMessageSignatureCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const uint256& hashIn) : pubkey(pubkeyIn), vchSig(vchSigIn), hash(hashIn) {}
+
+    /** Remember the signature if it is valid. Never fails the batch: the handler rejects bad signatures itself. */
+    bool operator()();
+
+    void swap(CMessageSignatureCheck& check)
+    {
+        std::swap(pubkey, check.pubkey);
+        vchSig.swap(check.vchSig);
+        std::swap(hash, check.hash);
+    }
+};
+
 class CObfuScationSigner
 {
+private:
+    CCriticalSection cs_verified;
+    /** Signatures found valid by CheckMasternodeMessageSignatures that no handler has consumed yet */
+    std::set<uint256> setVerified;
+
+    static uint256 GetVerifiedEntry(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const uint256& hash);
+
 public:
     /// Is the inputs associated with this public key? (and there is 10000 QBIC - checking if valid masternode)
     bool IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey);
@@ -258,6 +298,18 @@ public:
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Hash a string message the way SignMessage and VerifyMessage do
+    uint256 GetMessageHash(const std::string& strMessage) const;
+    /// Sign a message hash, returns true if successful
+    bool SignHash(const uint256& hash, std::string& errorMessage, std::vector<unsigned char>& vchSig, const CKey& key);
+    /// Verify a message hash against a known public key, returns true if successful
+    bool VerifyHash(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const uint256& hash, std::string& errorMessage);
+    /// Message version new masternode, SwiftX and budget messages are signed with
+    int GetMessageVersion() const;
+    /// Remember a signature checked ahead of its message, the next VerifyHash of it is free
+    void AddVerifiedSignature(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const uint256& hash);
+    /// Forget signatures checked ahead whose messages never got to VerifyHash
+    void TrimVerifiedSignatures();
 };
 
 /** Used to keep track of current status of Obfuscation pool
@@ -512,6 +564,13 @@ public:
     void RelayCompletedTransaction(const int sessionID, const bool error, const int errorID);
 };
 
-void ThreadCheckObfuScationPool();
+/** Schedule the masternode sync, list, payment, budget and obfuscation maintenance tasks */
+void StartMasternodeMaintenance(CScheduler& scheduler);
+/** Stop queueing the maintenance tasks on new tips, new peers and obfuscation messages */
+void StopMasternodeMaintenance();
+/** Run an instance of the masternode message signature checking thread */
+void ThreadMessageSignatureCheck();
+/** Check the signatures of the masternode, SwiftX and budget messages queued from pfrom in one batch */
+void CheckMasternodeMessageSignatures(CNode* pfrom);
 
 #endif
@@ -190,6 +190,12 @@ public:
      */
     static bool CheckLowS(const std::vector<unsigned char>& vchSig);
 
+    /**
+     * Verify a compact signature (65 bytes) against this key, without
+     * recovering the key from the signature first.
+     */
+    bool VerifyCompact(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+
     //! Recover a public key from a compact signature.
     bool RecoverCompact(const uint256& hash, const std::vector<unsigned char>& vchSig);
 
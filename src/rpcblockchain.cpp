@@ -121,7 +121,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     UniValue zpivObj(UniValue::VOBJ);
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        zpivObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        zpivObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->GetZerocoinSupply(denom) * (denom*COIN))));
     }
     zpivObj.push_back(Pair("total", ValueFromAmount(blockindex->GetZerocoinSupply())));
     result.push_back(Pair("zQBICsupply", zpivObj));
@@ -186,9 +186,8 @@ UniValue mempoolToJSON(bool fVerbose = false)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -196,6 +195,9 @@ UniValue mempoolToJSON(bool fVerbose = false)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", (int64_t)e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", (int64_t)e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", (int64_t)e.GetModFeesWithDescendants()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -249,6 +251,9 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees of in-mempool descendants, including prioritisetransaction deltas (including this one), in satoshis\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -464,6 +469,162 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue getcoinscacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoinscacheinfo\n"
+            "\nReturns details about the in-memory unspent transaction output cache.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": n,         (numeric) The number of transactions held in the cache\n"
+            "  \"usage\": n,           (numeric) The memory used by the cache, in bytes\n"
+            "  \"budget\": n,          (numeric) The usage above which the cache is flushed to disk, in bytes\n"
+            "  \"hits\": n,            (numeric) The number of lookups answered from the cache\n"
+            "  \"misses\": n,          (numeric) The number of lookups that went to the database\n"
+            "  \"flushes\": n,         (numeric) The number of flushes written to disk\n"
+            "  \"flush_pending\": true|false, (boolean) Whether a flush is being written in the background\n"
+            "  \"last_flush_stall_ms\": x.xx, (numeric) Time validation was held up by the last flush\n"
+            "  \"last_flush_write_ms\": x.xx, (numeric) Time the last flush took to reach the disk\n"
+            "  \"max_flush_write_ms\": x.xx,  (numeric) Longest such time\n"
+            "  \"avg_flush_write_ms\": x.xx   (numeric) Average such time\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getcoinscacheinfo", "") + HelpExampleRpc("getcoinscacheinfo", ""));
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("budget", (int64_t)nCoinCacheUsage));
+    ret.push_back(Pair("hits", (int64_t)pcoinsTip->GetCacheHits()));
+    ret.push_back(Pair("misses", (int64_t)pcoinsTip->GetCacheMisses()));
+
+    CChainStateFlushStats stats;
+    GetChainStateFlushStats(stats);
+    ret.push_back(Pair("flushes", (int64_t)stats.nFlushes));
+    ret.push_back(Pair("flush_pending", stats.fPending));
+    ret.push_back(Pair("last_flush_stall_ms", stats.nLastStall * 0.001));
+    ret.push_back(Pair("last_flush_write_ms", stats.nLastWrite * 0.001));
+    ret.push_back(Pair("max_flush_write_ms", stats.nMaxWrite * 0.001));
+    ret.push_back(Pair("avg_flush_write_ms", stats.nFlushes ? stats.nTotalWrite * 0.001 / stats.nFlushes : 0.0));
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getdbstats ( \"name\" )\n"
+            "\nReturns the options and usage statistics of the open LevelDB databases.\n"
+            "Counters cover the time since the database was opened.\n"
+
+            "\nArguments:\n"
+            "1. \"name\"     (string, optional) Only report the database in this directory (index, chainstate, zerocoin, sporks)\n"
+
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",          (string) The database directory name\n"
+            "    \"path\": \"xxxx\",          (string) The database path\n"
+            "    \"options\": {               (json object) The options in effect, see -dboption\n"
+            "      \"cache\": n,              (numeric) Block cache size in bytes\n"
+            "      \"writebuffer\": n,        (numeric) Write buffer size in bytes\n"
+            "      \"bloombits\": n,          (numeric) Bloom filter bits per key\n"
+            "      \"compression\": true|false,\n"
+            "      \"maxopenfiles\": n,\n"
+            "      \"blocksize\": n           (numeric) Block size in bytes\n"
+            "    },\n"
+            "    \"reads\": n,                (numeric) Point lookups\n"
+            "    \"reads_found\": n,          (numeric) Point lookups that found their key\n"
+            "    \"iterators\": n,            (numeric) Iterators created\n"
+            "    \"batches\": n,              (numeric) Batches written\n"
+            "    \"bytes_written\": n,        (numeric) Approximate bytes of batches written\n"
+            "    \"approximate_size\": n,     (numeric) Approximate size on disk in bytes\n"
+            "    \"tables_per_read\": n,      (numeric) Tables a lookup of a missing key may have to consult\n"
+            "    \"compaction_write_mb\": x.x, (numeric) MB written by memtable flushes and compactions\n"
+            "    \"write_amplification\": x.x, (numeric) Bytes written to disk per byte of batches, including the log\n"
+            "    \"levels\": [                (json array) Non-empty levels\n"
+            "      {\n"
+            "        \"level\": n,\n"
+            "        \"files\": n,\n"
+            "        \"size_mb\": x.x,\n"
+            "        \"compaction_sec\": x.x,\n"
+            "        \"read_mb\": x.x,\n"
+            "        \"write_mb\": x.x\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getdbstats", "") + HelpExampleCli("getdbstats", "\"chainstate\"") + HelpExampleRpc("getdbstats", "\"chainstate\""));
+
+    std::string strName;
+    if (params.size() > 0)
+        strName = params[0].get_str();
+
+    std::vector<CLevelDBStats> vStats;
+    GetLevelDBStats(vStats);
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH (const CLevelDBStats& stats, vStats) {
+        if (!strName.empty() && stats.strName != strName)
+            continue;
+
+        UniValue options(UniValue::VOBJ);
+        options.push_back(Pair("cache", (int64_t)stats.options.nBlockCache));
+        options.push_back(Pair("writebuffer", (int64_t)stats.options.nWriteBuffer));
+        options.push_back(Pair("bloombits", stats.options.nBloomBits));
+        options.push_back(Pair("compression", stats.options.fCompression));
+        options.push_back(Pair("maxopenfiles", stats.options.nMaxOpenFiles));
+        options.push_back(Pair("blocksize", (int64_t)stats.options.nBlockSize));
+
+        UniValue levels(UniValue::VARR);
+        int nTablesPerRead = 0;
+        double dCompactionWriteMB = 0;
+        BOOST_FOREACH (const CLevelDBLevelStats& level, stats.vLevels) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("level", level.nLevel));
+            obj.push_back(Pair("files", level.nFiles));
+            obj.push_back(Pair("size_mb", level.dSizeMB));
+            obj.push_back(Pair("compaction_sec", level.dTimeSec));
+            obj.push_back(Pair("read_mb", level.dReadMB));
+            obj.push_back(Pair("write_mb", level.dWriteMB));
+            levels.push_back(obj);
+
+            // Level-0 files overlap, so each may hold the key; deeper levels
+            // have at most one candidate table each.
+            if (level.nLevel == 0)
+                nTablesPerRead += level.nFiles;
+            else if (level.nFiles > 0)
+                nTablesPerRead++;
+            dCompactionWriteMB += level.dWriteMB;
+        }
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("path", stats.strPath));
+        obj.push_back(Pair("options", options));
+        obj.push_back(Pair("reads", (int64_t)stats.nReads));
+        obj.push_back(Pair("reads_found", (int64_t)stats.nReadsFound));
+        obj.push_back(Pair("iterators", (int64_t)stats.nIterators));
+        obj.push_back(Pair("batches", (int64_t)stats.nBatches));
+        obj.push_back(Pair("bytes_written", (int64_t)stats.nBytesWritten));
+        obj.push_back(Pair("approximate_size", (int64_t)stats.nApproximateSize));
+        obj.push_back(Pair("tables_per_read", nTablesPerRead));
+        obj.push_back(Pair("compaction_write_mb", dCompactionWriteMB));
+        double dWrittenMB = stats.nBytesWritten / 1048576.0;
+        obj.push_back(Pair("write_amplification", dWrittenMB > 0 ? 1.0 + dCompactionWriteMB / dWrittenMB : 0.0));
+        obj.push_back(Pair("levels", levels));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -728,7 +889,7 @@ UniValue getfeeinfo(const UniValue& params, bool fHelp)
             "  \"txbytes\": xxxxx                (numeric) Sum of all tx sizes\n"
             "  \"ttlfee\": xxxxx                 (numeric) Sum of all fees\n"
             "  \"feeperkb\": xxxxx               (numeric) Average fee per kb over the block range\n"
-            "  \"rec_highpriorityfee_perkb\": xxxxx    (numeric) Recommended fee per kb to use for a high priority tx\n"
+            "  \"rec_highpriorityfee_perkb\": xxxxx    (numeric) Recommended fee per kb to use for a high priority tx, from the fee estimator once it has data\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -787,11 +948,14 @@ UniValue getfeeinfo(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VOBJ);
     CFeeRate nFeeRate = CFeeRate(nFees, nBytes);
+    CFeeRate feeRecommended = mempool.estimateSmartFee(1);
+    if (feeRecommended == CFeeRate(0))
+        feeRecommended = CFeeRate(nFeeRate.GetFeePerK() + 1000);
     ret.push_back(Pair("txcount", (int64_t)nTotal));
     ret.push_back(Pair("txbytes", (int64_t)nBytes));
     ret.push_back(Pair("ttlfee", FormatMoney(nFees)));
     ret.push_back(Pair("feeperkb", FormatMoney(nFeeRate.GetFeePerK())));
-    ret.push_back(Pair("rec_highpriorityfee_perkb", FormatMoney(nFeeRate.GetFeePerK() + 1000)));
+    ret.push_back(Pair("rec_highpriorityfee_perkb", FormatMoney(feeRecommended.GetFeePerK())));
 
     return ret;
 }
@@ -801,7 +965,10 @@ UniValue mempoolInfoToJSON()
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    //ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
     return ret;
 }
@@ -817,6 +984,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in QBIC/kB for a transaction to be accepted\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -825,6 +995,22 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue savemempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "\nDumps the mempool to disk.\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("savemempool", "") + HelpExampleRpc("savemempool", ""));
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump mempool to disk");
+
+    return NullUniValue;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -307,6 +307,8 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getblockhash", &getblockhash, true, false, false},
         {"blockchain", "getblockheader", &getblockheader, false, false, false},
         {"blockchain", "getchaintips", &getchaintips, true, false, false},
+        {"blockchain", "getcoinscacheinfo", &getcoinscacheinfo, true, false, false},
+        {"blockchain", "getdbstats", &getdbstats, true, false, false},
         {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
         {"blockchain", "getfeeinfo", &getfeeinfo, true, false, false},
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
@@ -315,6 +317,7 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
         {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
         {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"blockchain", "savemempool", &savemempool, true, true, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
 
         /* Mining */
@@ -346,6 +349,8 @@ static const CRPCCommand vRPCCommands[] =
         {"util", "verifymessage", &verifymessage, true, false, false},
         {"util", "estimatefee", &estimatefee, true, true, false},
         {"util", "estimatepriority", &estimatepriority, true, true, false},
+        {"util", "estimatesmartfee", &estimatesmartfee, true, true, false},
+        {"util", "estimatesmartpriority", &estimatesmartpriority, true, true, false},
 
         /* Not shown in help */
         {"hidden", "invalidateblock", &invalidateblock, true, true, false},
@@ -5,13 +5,15 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace {
 
@@ -19,54 +21,95 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are salted SHA256 digests of (signature hash, public key,
+ * signature) stored in a fixed table of small buckets. The table is split
+ * into shards with a lock each, so the script check threads rarely wait on
+ * each other, and nothing is allocated after construction.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int SHARDS = 64;
+    static const unsigned int WAYS = 4;
+
+    struct Shard {
+        boost::mutex cs;
+        //! nBuckets groups of WAYS digests; null digests are free
+        std::vector<uint256> vEntries;
+    };
+
+    //! SHA256 state after hashing a random salt, so that nobody can
+    //! predict which entries share a bucket or evict each other
+    CSHA256 salted;
+    //! buckets per shard, 0 if the cache is disabled
+    size_t nBuckets;
+    Shard shards[SHARDS];
+
+    Shard& GetBucket(const uint256& entry, size_t& nFirst)
+    {
+        uint64_t n = ReadLE64(entry.begin());
+        nFirst = ((n / SHARDS) % nBuckets) * WAYS;
+        return shards[n % SHARDS];
+    }
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache()
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        // Pad the salt to a full SHA256 block so it is compressed only once
+        uint256 nonce = GetRandHash();
+        static const unsigned char padding[32] = {0};
+        salted.Write(nonce.begin(), 32).Write(padding, 32);
+
+        int64_t nMaxEntries = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+        nBuckets = nMaxEntries > 0 ? (nMaxEntries + SHARDS * WAYS - 1) / (SHARDS * WAYS) : 0;
+        for (unsigned int i = 0; i < SHARDS; i++)
+            shards[i].vEntries.resize(nBuckets * WAYS);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+    {
+        CSHA256(salted).Write(hash.begin(), 32).Write(pubKey.begin(), pubKey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    bool Get(const uint256& entry)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::set<sigdata_type>::iterator it = setValid.lower_bound(sigdata_type(randomHash));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        if (nBuckets == 0)
+            return false;
+
+        size_t nFirst;
+        Shard& shard = GetBucket(entry, nFirst);
+        boost::lock_guard<boost::mutex> lock(shard.cs);
+        for (size_t i = nFirst; i < nFirst + WAYS; i++) {
+            if (shard.vEntries[i] == entry)
+                return true;
         }
+        return false;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void Set(const uint256& entry)
+    {
+        if (nBuckets == 0)
+            return;
+
+        size_t nFirst;
+        Shard& shard = GetBucket(entry, nFirst);
+        boost::lock_guard<boost::mutex> lock(shard.cs);
+        // Take a free slot if there is one, otherwise evict the slot picked by
+        // the digest. Salting keeps that as unpredictable as a random choice,
+        // which foils would-be DoS attackers who might try to pre-generate
+        // and re-use a set of valid signatures just-slightly-greater than our
+        // cache size.
+        size_t nSlot = nFirst + entry.begin()[31] % WAYS;
+        for (size_t i = nFirst; i < nFirst + WAYS; i++) {
+            if (shard.vEntries[i] == entry)
+                return;
+            if (shard.vEntries[i].IsNull()) {
+                nSlot = i;
+                break;
+            }
+        }
+        shard.vEntries[nSlot] = entry;
     }
 };
 
@@ -76,13 +119,16 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
 {
     static CSignatureCache signatureCache;
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+
+    if (signatureCache.Get(entry))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
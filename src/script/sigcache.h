@@ -10,6 +10,9 @@
 
 #include <vector>
 
+//! Default for -maxsigcachesize, in entries of 32 bytes
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 50000;
+
 class CPubKey;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
@@ -118,6 +118,7 @@ public:
     bool empty() const { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c = 0) { vch.resize(n + nReadPos, c); }
     void reserve(size_type n) { vch.reserve(n + nReadPos); }
+    size_type capacity() const { return vch.capacity() - nReadPos; }
     const_reference operator[](size_type pos) const { return vch[pos + nReadPos]; }
     reference operator[](size_type pos) { return vch[pos + nReadPos]; }
     void clear()
@@ -125,6 +126,13 @@ public:
         vch.clear();
         nReadPos = 0;
     }
+    void swap(CDataStream& b)
+    {
+        vch.swap(b.vch);
+        std::swap(nReadPos, b.nReadPos);
+        std::swap(nType, b.nType);
+        std::swap(nVersion, b.nVersion);
+    }
     iterator insert(iterator it, const char& x = char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -481,8 +481,6 @@ uint256 CConsensusVote::GetHash() const
 bool CConsensusVote::SignatureValid()
 {
     std::string errorMessage;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
-    //LogPrintf("verify strMessage %s \n", strMessage.c_str());
 
     CMasternode* pmn = mnodeman.Find(vinMasternode);
 
@@ -491,7 +489,7 @@ bool CConsensusVote::SignatureValid()
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchMasterNodeSignature, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyHash(pmn->pubKeyMasternode, vchMasterNodeSignature, GetSignatureHash(), errorMessage)) {
         LogPrintf("SwiftX::CConsensusVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -505,21 +503,21 @@ bool CConsensusVote::Sign()
 
     CKey key2;
     CPubKey pubkey2;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
-    //LogPrintf("signing strMessage %s \n", strMessage.c_str());
-    //LogPrintf("signing privkey %s \n", strMasterNodePrivKey.c_str());
 
     if (!obfuScationSigner.SetKey(strMasterNodePrivKey, errorMessage, key2, pubkey2)) {
         LogPrintf("CConsensusVote::Sign() - ERROR: Invalid masternodeprivkey: '%s'\n", errorMessage.c_str());
         return false;
     }
 
-    if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchMasterNodeSignature, key2)) {
+    nMessVersion = obfuScationSigner.GetMessageVersion();
+    hashSignature.SetNull();
+
+    if (!obfuScationSigner.SignHash(GetSignatureHash(), errorMessage, vchMasterNodeSignature, key2)) {
         LogPrintf("CConsensusVote::Sign() - Sign message failed");
         return false;
     }
 
-    if (!obfuScationSigner.VerifyMessage(pubkey2, vchMasterNodeSignature, strMessage, errorMessage)) {
+    if (!obfuScationSigner.VerifyHash(pubkey2, vchMasterNodeSignature, GetSignatureHash(), errorMessage)) {
         LogPrintf("CConsensusVote::Sign() - Verify message failed");
         return false;
     }
@@ -527,6 +525,20 @@ bool CConsensusVote::Sign()
     return true;
 }
 
+uint256 CConsensusVote::GetSignatureHash() const
+{
+    if (hashSignature.IsNull()) {
+        if (nMessVersion == MESS_VER_STRMESS) {
+            hashSignature = obfuScationSigner.GetMessageHash(txHash.ToString() + boost::lexical_cast<std::string>(nBlockHeight));
+        } else {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << std::string("txlvote") << nMessVersion << vinMasternode.prevout << txHash << nBlockHeight;
+            hashSignature = ss.GetHash();
+        }
+    }
+    return hashSignature;
+}
+
 
 bool CTransactionLock::SignaturesValid()
 {
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "key.h"
 #include "main.h"
+#include "masternode.h"
 #include "net.h"
 #include "spork.h"
 #include "sync.h"
@@ -69,17 +70,26 @@ int64_t GetAverageVoteTime();
 
 class CConsensusVote
 {
+private:
+    mutable uint256 hashSignature; //! cache for GetSignatureHash()
+
 public:
     CTxIn vinMasternode;
     uint256 txHash;
     int nBlockHeight;
     std::vector<unsigned char> vchMasterNodeSignature;
+    int nMessVersion;
+
+    CConsensusVote() : nBlockHeight(0), nMessVersion(MESS_VER_STRMESS) {}
 
     uint256 GetHash() const;
 
     bool SignatureValid();
     bool Sign();
 
+    /// The hash the signature covers, in the format given by nMessVersion
+    uint256 GetSignatureHash() const;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -89,6 +99,10 @@ public:
         READWRITE(vinMasternode);
         READWRITE(vchMasterNodeSignature);
         READWRITE(nBlockHeight);
+        if (nVersion >= MESSAGE_VERSION_PROTO)
+            READWRITE(nMessVersion);
+        if (ser_action.ForRead())
+            hashSignature.SetNull();
     }
 };
 
@@ -3,6 +3,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "masternode-budget.h"
 #include "tinyformat.h"
 #include "utilmoneystr.h"
@@ -30,4 +31,58 @@ BOOST_AUTO_TEST_CASE(budget_value)
     CheckBudgetValue(nHeightTest, "mainnet", 43200*COIN);
 }
 
+static CBudgetVote BudgetVote(uint256 nProposalHash, int n, int nVote, int64_t nTime)
+{
+    CBudgetVote vote(CTxIn(COutPoint(uint256(n + 1), 0)), nProposalHash, nVote);
+    vote.nTime = nTime;
+    return vote;
+}
+
+BOOST_AUTO_TEST_CASE(budget_vote_tallies)
+{
+    CBudgetProposal proposal;
+    uint256 nHash = proposal.GetHash();
+    int64_t nTime = GetTime() - BUDGET_VOTE_UPDATE_MIN;
+    std::string strError;
+
+    CBudgetVote vote = BudgetVote(nHash, 0, VOTE_YES, nTime);
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    vote = BudgetVote(nHash, 1, VOTE_YES, nTime);
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    vote = BudgetVote(nHash, 2, VOTE_NO, nTime);
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    vote = BudgetVote(nHash, 3, VOTE_ABSTAIN, nTime);
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 1);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 1);
+
+    // Changing a vote moves it between the tallies, too early a change is refused
+    vote = BudgetVote(nHash, 1, VOTE_NO, nTime + 1);
+    BOOST_CHECK(!proposal.AddOrUpdateVote(vote, strError));
+    vote = BudgetVote(nHash, 1, VOTE_NO, nTime + BUDGET_VOTE_UPDATE_MIN);
+    BOOST_CHECK(proposal.AddOrUpdateVote(vote, strError));
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 1);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 2);
+    BOOST_CHECK_CLOSE(proposal.GetRatio(), 1.0 / 3, 1e-6);
+
+    // Copies and deserialized proposals count the same votes
+    CBudgetProposal copy(proposal);
+    BOOST_CHECK_EQUAL(copy.GetNays(), 2);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << proposal;
+    CBudgetProposal loaded;
+    ss >> loaded;
+    BOOST_CHECK_EQUAL(loaded.GetYeas(), 1);
+    BOOST_CHECK_EQUAL(loaded.GetNays(), 2);
+
+    // None of the voters are known masternodes, cleaning drops them from the
+    // valid tallies while the ratio keeps counting every vote
+    proposal.CleanAndRemove(false);
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 0);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 0);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 0);
+    BOOST_CHECK_CLOSE(proposal.GetRatio(), 1.0 / 3, 1e-6);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
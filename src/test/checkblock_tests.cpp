@@ -8,8 +8,12 @@
 
 
 
+#include "chainparams.h"
 #include "clientversion.h"
 #include "main.h"
+#include "random.h"
+#include "script/script.h"
+#include "timedata.h"
 #include "utiltime.h"
 
 #include <cstdio>
@@ -66,4 +70,51 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+static void SolveBlock(CBlock& block)
+{
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    while (!CheckProofOfWork(block.GetHash(), block.nBits))
+        block.nNonce++;
+}
+
+BOOST_AUTO_TEST_CASE(CheckBlock_tx_checks)
+{
+    CBlock block;
+    block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    block.nTime = GetAdjustedTime();
+    block.nBits = Params().ProofOfWorkLimit().GetCompact();
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(CTransaction(coinbase));
+
+    std::vector<CMutableTransaction> vtx(20);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].prevout = COutPoint(GetRandHash(), 0);
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].nValue = COIN;
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_TRUE;
+        block.vtx.push_back(CTransaction(vtx[i]));
+    }
+    SolveBlock(block);
+
+    // The transaction checks run on the check queue threads
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state));
+    BOOST_CHECK(state.IsValid());
+
+    // A failing transaction check still reports why the block is invalid
+    vtx[13].vout[0].nValue = -1;
+    block.vtx[14] = CTransaction(vtx[13]);
+    SolveBlock(block);
+    BOOST_CHECK(!CheckBlock(block, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-vout-negative");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
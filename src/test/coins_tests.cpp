@@ -3,12 +3,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "memusage.h"
 #include "random.h"
+#include "script/script.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -58,6 +62,54 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    //! Store coins the way the per-transaction layout did
+    void WriteLegacy(const uint256& txid, const CCoins& coins, const uint256& hashBlock)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+        db.Write('B', hashBlock);
+    }
+
+    bool HaveLegacy(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid)) || db.Exists('B');
+    }
+};
+
+CCoins RandomCoins(unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = insecure_rand() % 100000;
+    coins.fCoinStake = true;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = insecure_rand() % 100000000 + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE << i;
+    }
+    return coins;
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +141,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +167,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                coins.vout[0].scriptPubKey.resize(insecure_rand() % 64);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,6 +188,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +207,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +231,154 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_buffered_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewBuffered buffer(&base);
+    CCoinsViewCacheTest cache(&buffer);
+
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsModifier entry = cache.ModifyCoins(txid);
+        entry->nVersion = 1;
+        entry->vout.resize(1);
+        entry->vout[0].nValue = 42;
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // Until it is written, the flushed entry is only in the buffer.
+    BOOST_CHECK(!buffer.IsEmpty());
+    BOOST_CHECK(!base.HaveCoins(txid));
+    BOOST_CHECK(buffer.GetBestBlock() == hashBlock);
+    BOOST_CHECK(cache.HaveCoins(txid));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 42);
+
+    // Spend it in the cache while the buffer still holds the unspent version.
+    cache.ModifyCoins(txid)->Clear();
+    BOOST_CHECK(!cache.HaveCoins(txid));
+
+    BOOST_CHECK(buffer.Write());
+    BOOST_CHECK(buffer.IsEmpty());
+    BOOST_CHECK(base.HaveCoins(txid));
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+
+    // The spend reaches the base with the next flush.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(buffer.HaveCoins(txid) == false);
+    BOOST_CHECK(buffer.Write());
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txid, coins) || coins.IsPruned());
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDBTest db;
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins expected = RandomCoins(20);
+    CCoins coins;
+
+    BOOST_CHECK(!db.GetCoins(txid, coins));
+    BOOST_CHECK(!db.HaveCoins(txid));
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyCoins(txid) = expected;
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == expected);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // Spend single outputs, including the last one, over several flushes.
+    unsigned int vSpend[] = {5, 0, 19, 18};
+    BOOST_FOREACH (unsigned int n, vSpend) {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(n));
+        BOOST_CHECK(expected.Spend(n));
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(db.GetCoins(txid, coins));
+        BOOST_CHECK(coins == expected);
+    }
+
+    // Spending the rest removes the transaction.
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.GetCoins(txid, coins));
+    BOOST_CHECK(!db.HaveCoins(txid));
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_upgrade_test)
+{
+    CCoinsViewDBTest db;
+    uint256 hashBlock = GetRandHash();
+    std::map<uint256, CCoins> expected;
+    for (unsigned int i = 0; i < 10; i++) {
+        CCoins coins = RandomCoins(1 + insecure_rand() % 30);
+        for (unsigned int n = 1; n < coins.vout.size(); n++) {
+            if (insecure_rand() % 3 == 0)
+                coins.Spend(n);
+        }
+        uint256 txid = GetRandHash();
+        db.WriteLegacy(txid, coins, hashBlock);
+        expected[txid] = coins;
+    }
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (std::map<uint256, CCoins>::iterator it = expected.begin(); it != expected.end(); it++) {
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(it->first, coins));
+        BOOST_CHECK(coins == it->second);
+        BOOST_CHECK(!db.HaveLegacy(it->first));
+    }
+
+    // Nothing left to do the second time.
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_options_test)
+{
+    mapMultiArgs["-dboption"].push_back("chainstate.bloombits=5");
+    mapMultiArgs["-dboption"].push_back("chainstate.cache=3");
+    mapMultiArgs["-dboption"].push_back("index.compression=1");
+    CLevelDBWrapper db(GetDataDir() / "chainstate", 1 << 20, true);
+    mapMultiArgs.erase("-dboption");
+
+    CLevelDBStats stats;
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.strName, "chainstate");
+    BOOST_CHECK_EQUAL(stats.options.nBloomBits, 5);
+    BOOST_CHECK_EQUAL(stats.options.nBlockCache, (size_t)3 << 20);
+    BOOST_CHECK_EQUAL(stats.options.nWriteBuffer, (size_t)1 << 18);
+    BOOST_CHECK(!stats.options.fCompression);
+
+    CLevelDBBatch batch;
+    batch.Write('k', 1);
+    BOOST_CHECK(db.WriteBatch(batch));
+    int n;
+    BOOST_CHECK(db.Read('k', n));
+    BOOST_CHECK(!db.Exists('x'));
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nReads, 2U);
+    BOOST_CHECK_EQUAL(stats.nReadsFound, 1U);
+    BOOST_CHECK_EQUAL(stats.nBatches, 1U);
+    BOOST_CHECK(stats.nBytesWritten > 0);
+
+    std::vector<CLevelDBStats> vStats;
+    GetLevelDBStats(vStats);
+    bool fFound = false;
+    BOOST_FOREACH (const CLevelDBStats& s, vStats)
+        fFound |= s.strPath == stats.strPath && s.nBatches == 1;
+    BOOST_CHECK(fFound);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
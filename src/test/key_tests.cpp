@@ -164,6 +164,19 @@ BOOST_AUTO_TEST_CASE(key_test1)
         BOOST_CHECK(rkey2  == pubkey2);
         BOOST_CHECK(rkey1C == pubkey1C);
         BOOST_CHECK(rkey2C == pubkey2C);
+
+        // compact signatures checked against a known key
+
+        BOOST_CHECK( pubkey1.VerifyCompact (hashMsg, csign1));
+        BOOST_CHECK( pubkey2.VerifyCompact (hashMsg, csign2));
+        BOOST_CHECK( pubkey1C.VerifyCompact(hashMsg, csign1C));
+        BOOST_CHECK( pubkey2C.VerifyCompact(hashMsg, csign2C));
+
+        BOOST_CHECK(!pubkey1.VerifyCompact (hashMsg, csign2));
+        BOOST_CHECK(!pubkey1.VerifyCompact (hashMsg, csign1C));
+        BOOST_CHECK(!pubkey1C.VerifyCompact(hashMsg, csign1));
+        BOOST_CHECK(!pubkey2C.VerifyCompact(hashMsg, csign1C));
+        BOOST_CHECK(!pubkey1.VerifyCompact (Hash(strMsg.begin(), strMsg.end() - 1), csign1));
     }
 
     // test deterministic signing
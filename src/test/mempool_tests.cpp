@@ -99,4 +99,140 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+static CMutableTransaction MakeTx(const uint256& hashPrev, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = nValue;
+    return tx;
+}
+
+static void CheckDescendantOrder(CTxMemPool& pool, const std::vector<uint256>& sortedOrder)
+{
+    BOOST_CHECK_EQUAL(pool.size(), sortedOrder.size());
+    CTxMemPool::indexed_transaction_set::index<descendant_score>::type::iterator it = pool.mapTx.get<descendant_score>().begin();
+    for (unsigned int i = 0; it != pool.mapTx.get<descendant_score>().end(); ++it, ++i)
+        BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[i].ToString());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // All transactions have the same size, so they sort by fee and then
+    // newest first.
+    CMutableTransaction tx1 = MakeTx(uint256(1), 1 * COIN);
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 0.0, 1));
+    CMutableTransaction tx2 = MakeTx(uint256(2), 2 * COIN);
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 20000LL, 0, 0.0, 1));
+    CMutableTransaction tx3 = MakeTx(uint256(3), 3 * COIN);
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0LL, 0, 0.0, 1));
+    CMutableTransaction tx4 = MakeTx(uint256(4), 4 * COIN);
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 15000LL, 0, 0.0, 1));
+    CMutableTransaction tx5 = MakeTx(uint256(5), 5 * COIN);
+    pool.addUnchecked(tx5.GetHash(), CTxMemPoolEntry(tx5, 10000LL, 1, 0.0, 1));
+
+    std::vector<uint256> sortedOrder;
+    sortedOrder.push_back(tx3.GetHash());
+    sortedOrder.push_back(tx5.GetHash());
+    sortedOrder.push_back(tx1.GetHash());
+    sortedOrder.push_back(tx4.GetHash());
+    sortedOrder.push_back(tx2.GetHash());
+    CheckDescendantOrder(pool, sortedOrder);
+
+    // A high fee child pays for its parent: tx3 and tx6 together pay more
+    // per byte than any other transaction.
+    CMutableTransaction tx6 = MakeTx(tx3.GetHash(), 3 * COIN);
+    pool.addUnchecked(tx6.GetHash(), CTxMemPoolEntry(tx6, 50000LL, 0, 0.0, 1));
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithDescendants(), 50000LL);
+    BOOST_CHECK(pool.GetMemPoolChildren(it3).count(pool.mapTx.find(tx6.GetHash())));
+
+    sortedOrder.erase(sortedOrder.begin());
+    sortedOrder.push_back(tx3.GetHash());
+    sortedOrder.push_back(tx6.GetHash());
+    CheckDescendantOrder(pool, sortedOrder);
+
+    // Prioritising the parent moves the package up as well
+    pool.PrioritiseTransaction(tx5.GetHash(), tx5.GetHash().ToString(), 0.0, 100000LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx5.GetHash())->GetModFeesWithDescendants(), 110000LL);
+    sortedOrder.erase(sortedOrder.begin());
+    sortedOrder.push_back(tx5.GetHash());
+    CheckDescendantOrder(pool, sortedOrder);
+
+    // Removing the child takes it out of the parent's descendant state
+    std::list<CTransaction> removed;
+    pool.remove(tx6, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1U);
+    it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetCountWithDescendants(), 1U);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithDescendants(), 0LL);
+    BOOST_CHECK(pool.GetMemPoolChildren(it3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+
+    CMutableTransaction tx1 = MakeTx(uint256(1), 1 * COIN);
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000LL, 0, 0.0, 1));
+    CMutableTransaction tx2 = MakeTx(uint256(2), 2 * COIN);
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000LL, 0, 0.0, 1));
+    BOOST_CHECK(pool.DynamicMemoryUsage() > 0);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage()); // should do nothing
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1); // should remove the lower-feerate transaction
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+
+    // The minimum fee is now the evicted fee rate plus the relay fee
+    unsigned int nTxSize = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+    CAmount nMinFee = CFeeRate(5000LL, nTxSize).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee);
+
+    // A zero-fee parent with a high-fee child outranks tx1 as a package
+    CMutableTransaction tx3 = MakeTx(uint256(3), 3 * COIN);
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0LL, 0, 0.0, 1));
+    CMutableTransaction tx4 = MakeTx(tx3.GetHash(), 3 * COIN);
+    pool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 30000LL, 0, 0.0, 1));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+    BOOST_CHECK(pool.exists(tx4.GetHash()));
+
+    // The package is evicted as a whole
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0U);
+    nMinFee = CFeeRate(30000LL, 2 * nTxSize).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee);
+
+    // After a block the minimum fee decays with a half-life, until it drops
+    // below half the relay fee
+    SetMockTime(42);
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee);
+
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFee / 2);
+
+    SetMockTime(42 + 10 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
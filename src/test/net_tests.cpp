@@ -0,0 +1,85 @@
+// Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2018 The QBICcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "serialize.h"
+#include "streams.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+static CDataStream MakeMessage(const char* pszCommand, const std::vector<unsigned char>& vPayload)
+{
+    CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(pszCommand, vPayload.size());
+    uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    ssMsg << hdr;
+    ssMsg.write((const char*)&vPayload[0], vPayload.size());
+    return ssMsg;
+}
+
+BOOST_AUTO_TEST_CASE(netmessage_incremental_hash)
+{
+    CAddress addr(CService("127.0.0.1", Params().GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    std::vector<unsigned char> vPayload(300000);
+    for (unsigned int i = 0; i < vPayload.size(); i++)
+        vPayload[i] = (unsigned char)(i * 7);
+    CDataStream ssMsg = MakeMessage("block", vPayload);
+
+    // Feed the message in odd sized chunks, like the socket handler would
+    LOCK(node.cs_vRecvMsg);
+    for (unsigned int nPos = 0; nPos < ssMsg.size(); nPos += 1021)
+        BOOST_CHECK(node.ReceiveMsgBytes(&ssMsg[nPos], std::min((unsigned int)ssMsg.size() - nPos, 1021u)));
+
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 1U);
+    CNetMessage& msg = node.vRecvMsg.front();
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK(msg.GetMessageHash() == Hash(vPayload.begin(), vPayload.end()));
+    BOOST_CHECK(msg.vRecv.str() == std::string(vPayload.begin(), vPayload.end()));
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CAddress addr(CService("127.0.0.1", Params().GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    LOCK(node.cs_vRecvMsg);
+
+    std::vector<unsigned char> vPayload(50000, 0x5a);
+    for (int i = 0; i < 3; i++) {
+        CDataStream ssMsg = MakeMessage("tx", vPayload);
+        BOOST_CHECK(node.ReceiveMsgBytes(&ssMsg[0], ssMsg.size()));
+        BOOST_CHECK(node.vRecvMsg.back().complete());
+        BOOST_CHECK(node.vRecvMsg.back().GetMessageHash() == Hash(vPayload.begin(), vPayload.end()));
+
+        // Processed messages hand their buffer back to the pool
+        node.RecycleRecvMsg(node.vRecvMsg.front());
+        node.vRecvMsg.pop_front();
+        BOOST_CHECK(node.recvBufferPool.GetPooledBytes() >= vPayload.size());
+        BOOST_CHECK(node.GetTotalRecvSize() >= vPayload.size());
+    }
+
+    // The first message had to allocate, later ones reuse the pooled buffer
+    BOOST_CHECK_EQUAL(node.recvBufferPool.GetMisses(), 1U);
+    BOOST_CHECK_EQUAL(node.recvBufferPool.GetHits(), 2U);
+
+    // A buffer that is too small for the request is not handed out
+    CDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!node.recvBufferPool.Take(RECV_BUFFER_STEP, vRecv));
+    BOOST_CHECK(node.recvBufferPool.Take(1000, vRecv));
+    BOOST_CHECK(vRecv.empty());
+    BOOST_CHECK(vRecv.capacity() >= vPayload.size());
+    BOOST_CHECK_EQUAL(node.recvBufferPool.GetPooledBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include "random.h"
 #include "util.h"
 
+#include <iostream>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -45,6 +46,63 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(arena_test)
+{
+    // Entries allocated one by one in scrambled order, as when they were created
+    // while loading the index in hash order, against entries from an arena
+    std::vector<int> vOrder(SKIPLIST_LENGTH);
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vOrder[i] = i;
+        std::swap(vOrder[i], vOrder[insecure_rand() % (i + 1)]);
+    }
+
+    std::vector<CBlockIndex*> vHeap(SKIPLIST_LENGTH);
+    for (int i=0; i<SKIPLIST_LENGTH; i++)
+        vHeap[vOrder[i]] = new CBlockIndex();
+
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vArena(SKIPLIST_LENGTH);
+    for (int i=0; i<SKIPLIST_LENGTH; i++)
+        vArena[i] = arena.Create();
+    BOOST_CHECK_EQUAL(arena.Size(), SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vHeap[i]->nHeight = vArena[i]->nHeight = i;
+        vHeap[i]->pprev = (i == 0) ? NULL : vHeap[i - 1];
+        vArena[i]->pprev = (i == 0) ? NULL : vArena[i - 1];
+        vHeap[i]->BuildSkip();
+        vArena[i]->BuildSkip();
+    }
+
+    std::vector<std::pair<int, int> > vWalks;
+    for (int i=0; i < 100000; i++) {
+        int from = insecure_rand() % SKIPLIST_LENGTH;
+        vWalks.push_back(std::make_pair(from, insecure_rand() % (from + 1)));
+    }
+
+    std::vector<CBlockIndex*>* vLayouts[] = {&vHeap, &vArena};
+    for (std::vector<CBlockIndex*>* pvIndex : vLayouts) {
+        const std::vector<CBlockIndex*>& vIndex = *pvIndex;
+        int64_t nStart = GetTimeMicros();
+        int nErrors = 0;
+        for (const std::pair<int, int>& walk : vWalks)
+            nErrors += vIndex[walk.first]->GetAncestor(walk.second) != vIndex[walk.second];
+        int64_t nAncestors = GetTimeMicros();
+        int nLength = 0;
+        for (const CBlockIndex* pindex = vIndex.back(); pindex; pindex = pindex->pprev)
+            nLength++;
+        int64_t nEnd = GetTimeMicros();
+
+        BOOST_CHECK_EQUAL(nErrors, 0);
+        BOOST_CHECK_EQUAL(nLength, SKIPLIST_LENGTH);
+        std::cout << (pvIndex == &vHeap ? "heap" : "arena") << ": " << vWalks.size() << " GetAncestor calls " << nAncestors - nStart
+             << "us, full pprev walk " << nEnd - nAncestors << "us\n";
+    }
+
+    for (CBlockIndex* pindex : vHeap)
+        delete pindex;
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
@@ -47,7 +47,8 @@ struct TestingSetup {
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsBuffer = new CCoinsViewBuffered(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsBuffer);
         InitBlockIndex();
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -56,8 +57,10 @@ struct TestingSetup {
         RegisterValidationInterface(pwalletMain);
 #endif
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadTxCheck);
+        }
         RegisterNodeSignals(GetNodeSignals());
     }
     ~TestingSetup()
@@ -70,6 +73,7 @@ struct TestingSetup {
         pwalletMain = NULL;
 #endif
         delete pcoinsTip;
+        delete pcoinsBuffer;
         delete pcoinsdbview;
         delete pblocktree;
 #ifdef ENABLE_WALLET
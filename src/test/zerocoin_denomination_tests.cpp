@@ -70,6 +70,42 @@ BOOST_AUTO_TEST_CASE(denomination_to_value_test)
     BOOST_CHECK_MESSAGE(ZerocoinDenominationToAmount(denomination) == Value, "Wrong Value - should be 0");
 }
 
+BOOST_AUTO_TEST_CASE(block_index_zerocoin_serialization_test)
+{
+    cout << "Running block_index_zerocoin_serialization_test...\n";
+
+    // Block index entries were written with the zerocoin fields as a map and a vector
+    std::map<CoinDenomination, int64_t> mapSupply;
+    for (unsigned int i = 0; i < zerocoinDenomList.size(); i++)
+        mapSupply[zerocoinDenomList[i]] = i * 1000 + 7;
+    std::vector<CoinDenomination> vMints = {ZQ_FIVE, ZQ_ONE, ZQ_FIVE, ZQ_FIVE_THOUSAND};
+
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << mapSupply << vMints;
+
+    CBlockIndex index;
+    ssOld >> REF(CZerocoinSupplySerializer(index.nZerocoinSupply)) >> REF(CZerocoinMintsSerializer(index.nMintsInBlock));
+    BOOST_CHECK(ssOld.empty());
+    for (unsigned int i = 0; i < zerocoinDenomList.size(); i++)
+        BOOST_CHECK_EQUAL(index.GetZerocoinSupply(zerocoinDenomList[i]), mapSupply[zerocoinDenomList[i]]);
+    BOOST_CHECK_EQUAL(index.GetMintCount(ZQ_ONE), 1);
+    BOOST_CHECK_EQUAL(index.GetMintCount(ZQ_FIVE), 2);
+    BOOST_CHECK_EQUAL(index.GetMintCount(ZQ_TEN), 0);
+    BOOST_CHECK(index.MintedDenomination(ZQ_FIVE_THOUSAND));
+
+    // Written back they read as the same map, and the vector in denomination order
+    CDataStream ssNew(SER_DISK, CLIENT_VERSION);
+    ssNew << REF(CZerocoinSupplySerializer(index.nZerocoinSupply)) << REF(CZerocoinMintsSerializer(index.nMintsInBlock));
+    BOOST_CHECK_EQUAL(ssNew.size(), ::GetSerializeSize(REF(CZerocoinSupplySerializer(index.nZerocoinSupply)), SER_DISK, CLIENT_VERSION) +
+                                        ::GetSerializeSize(REF(CZerocoinMintsSerializer(index.nMintsInBlock)), SER_DISK, CLIENT_VERSION));
+    std::map<CoinDenomination, int64_t> mapSupplyNew;
+    std::vector<CoinDenomination> vMintsNew;
+    ssNew >> mapSupplyNew >> vMintsNew;
+    BOOST_CHECK(mapSupplyNew == mapSupply);
+    std::sort(vMints.begin(), vMints.end());
+    BOOST_CHECK(vMintsNew == vMints);
+}
+
 BOOST_AUTO_TEST_CASE(zerocoin_spend_test241)
 {
     const int nMaxNumberOfSpends = 4;
@@ -294,6 +294,13 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     CoinSpend spend1(Params().Zerocoin_Params(true), Params().Zerocoin_Params(false), serializedCoinSpend);
     BOOST_CHECK_MESSAGE(spend1.Verify(accumulator), "Failed deserialized check of CoinSpend");
 
+    // Decoding the same input again is served from the decoded spend cache
+    uint64_t nDecodes = GetZerocoinSpendDecodeCount();
+    CoinSpend spend2 = TxInToZerocoinSpend(newTxIn);
+    CoinSpend spend3 = TxInToZerocoinSpend(newTxIn);
+    BOOST_CHECK_MESSAGE(GetZerocoinSpendDecodeCount() == nDecodes + 1, "CoinSpend was decoded more than once");
+    BOOST_CHECK(spend3.getCoinSerialNumber() == spend1.getCoinSerialNumber());
+
     CScript script;
     CTxOut txOut(1 * COIN, script);
 
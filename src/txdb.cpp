@@ -10,25 +10,140 @@
 #include "pow.h"
 #include "uint256.h"
 #include "accumulators.h"
+#include "random.h"
+#include "ui_interface.h"
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 using namespace libzerocoin;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+/**
+ * The chainstate keeps one 'h' record per transaction with unspent outputs,
+ * holding what CCoins knows about the transaction as a whole, and one 'o'
+ * record per unspent output, keyed by (txid, index). Spending an output
+ * erases just its record. The best block is kept under 'H'; 'B' and
+ * per-transaction 'c' records belong to the older layout, see Upgrade().
+ */
+namespace
+{
+class CCoinsHeader
+{
+public:
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    bool fCoinStake;
+
+    CCoinsHeader() : nVersion(0), nHeight(0), fCoinBase(false), fCoinStake(false) {}
+    CCoinsHeader(const CCoins& coins) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake) {}
+
+    bool operator==(const CCoinsHeader& other) const
+    {
+        return nVersion == other.nVersion && nHeight == other.nHeight && fCoinBase == other.fCoinBase && fCoinStake == other.fCoinStake;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn)
+    {
+        READWRITE(VARINT(nVersion));
+        unsigned int nCode = nHeight * 4 + (fCoinBase ? 1 : 0) + (fCoinStake ? 2 : 0);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 4;
+            fCoinBase = nCode & 1;
+            fCoinStake = (nCode & 2) != 0;
+        }
+    }
+};
+
+/** Length of the serialized ('o', txid) prefix shared by the output records of a transaction */
+const size_t OUTPUT_KEY_PREFIX_SIZE = 1 + 32;
+
+/**
+ * Read the output records of txid into vout, with null outputs for the ones
+ * that have no record. pcursor is left after the last of them.
+ */
+void ReadCoinsOutputs(leveldb::Iterator* pcursor, const uint256& txid, std::vector<CTxOut>& vout)
+{
+    vout.clear();
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << make_pair('o', txid);
+    pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size()));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != OUTPUT_KEY_PREFIX_SIZE + 4 || memcmp(slKey.data(), &ssPrefix[0], OUTPUT_KEY_PREFIX_SIZE) != 0)
+            break;
+        CDataStream ssKey(slKey.data() + OUTPUT_KEY_PREFIX_SIZE, slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        uint32_t n;
+        ssKey >> n;
+        if (n >= vout.size())
+            vout.resize(n + 1);
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        CTxOutCompressor compressor(vout[n]);
+        ssValue >> compressor;
+    }
+}
+
+/**
+ * Queue the records that turn the stored outputs vOnDisk of hash (as read by
+ * ReadCoinsOutputs) into coins. Outputs that did not change are not touched.
+ */
+void BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins, const std::vector<CTxOut>& vOnDisk, const CCoinsHeader* pheaderOnDisk)
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+    if (coins.IsPruned()) {
+        if (pheaderOnDisk)
+            batch.Erase(make_pair('h', hash));
+        for (uint32_t n = 0; n < vOnDisk.size(); n++) {
+            if (!vOnDisk[n].IsNull())
+                batch.Erase(make_pair('o', make_pair(hash, n)));
+        }
+        return;
+    }
+
+    CCoinsHeader header(coins);
+    if (!pheaderOnDisk || !(*pheaderOnDisk == header))
+        batch.Write(make_pair('h', hash), header);
+    for (uint32_t n = 0; n < std::max(coins.vout.size(), vOnDisk.size()); n++) {
+        bool fHave = n < coins.vout.size() && !coins.vout[n].IsNull();
+        bool fHad = n < vOnDisk.size() && !vOnDisk[n].IsNull();
+        if (fHave && !fHad)
+            batch.Write(make_pair('o', make_pair(hash, n)), CTxOutCompressor(REF(coins.vout[n])));
+        else if (fHad && !fHave)
+            batch.Erase(make_pair('o', make_pair(hash, n)));
+    }
+}
+
+/** Erase every record of the given type from db, in batches */
+bool EraseRecords(CLevelDBWrapper& db, char chType)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << chType;
+    CLevelDBBatch batch;
+    for (pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size())); pcursor->Valid() && pcursor->key()[0] == chType; pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        char* pkey = const_cast<char*>(slKey.data());
+        batch.Erase(CFlatData(pkey, pkey + slKey.size()));
+        if (batch.SizeEstimate() > COINS_DB_UPGRADE_BATCH_SIZE) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch);
 }
+} // anonymous namespace
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
 {
-    batch.Write('B', hash);
+    batch.Write('H', hash);
 }
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
@@ -37,18 +152,28 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    // A lookup of a missing transaction stops at the (bloom filtered) header.
+    CCoinsHeader header;
+    if (!db.Read(make_pair('h', txid), header))
+        return false;
+    coins.nVersion = header.nVersion;
+    coins.nHeight = header.nHeight;
+    coins.fCoinBase = header.fCoinBase;
+    coins.fCoinStake = header.fCoinStake;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    ReadCoinsOutputs(pcursor.get(), txid, coins.vout);
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(make_pair('h', txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
     uint256 hashBestChain;
-    if (!db.Read('B', hashBestChain))
+    if (!db.Read('H', hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
@@ -58,22 +183,91 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    // Compare against what is stored now, to write only the outputs that changed.
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    std::vector<CTxOut> vOnDisk;
+    // The map is left untouched: CCoinsViewBuffered keeps serving lookups from
+    // it while it is being written.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            vOnDisk.clear();
+            CCoinsHeader header;
+            bool fOnDisk = false;
+            // Entries marked fresh are known to have nothing stored.
+            if (!(it->second.flags & CCoinsCacheEntry::FRESH) && db.Read(make_pair('h', it->first), header)) {
+                fOnDisk = true;
+                ReadCoinsOutputs(pcursor.get(), it->first, vOnDisk);
+            }
+            BatchWriteCoins(batch, it->first, it->second.coins, vOnDisk, fOnDisk ? &header : NULL);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database (%u bytes)...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)batch.SizeEstimate());
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    // 'B' is only written by the per-transaction layout, and erased once an
+    // upgrade is complete. If it is there, the 'c' records are the chainstate:
+    // drop any output records (from an interrupted upgrade, or from before
+    // running an older version) and convert them again.
+    uint256 hashBestChain;
+    if (!db.Read('B', hashBestChain)) {
+        // Clear out the 'c' records of a completed upgrade that was interrupted.
+        return EraseRecords(db, 'c');
+    }
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Upgrading chainstate database to per-output records...\n");
+    uiInterface.InitMessage(_("Upgrading chainstate database..."));
+    if (!EraseRecords(db, 'h') || !EraseRecords(db, 'o'))
+        return error("%s : failed to erase output records", __func__);
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'c';
+    CLevelDBBatch batch;
+    size_t nTransactions = 0, nOutputs = 0;
+    std::vector<CTxOut> vNone;
+    for (pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size())); pcursor->Valid() && pcursor->key()[0] == 'c'; pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txid;
+            ssKey >> chType >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            BatchWriteCoins(batch, txid, coins, vNone, NULL);
+            nTransactions++;
+            for (unsigned int i = 0; i < coins.vout.size(); i++)
+                nOutputs += !coins.vout[i].IsNull();
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        if (batch.SizeEstimate() > COINS_DB_UPGRADE_BATCH_SIZE) {
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+    // Switch over to the new records in one go, then remove the old ones.
+    batch.Write('H', hashBestChain);
+    batch.Erase('B');
+    db.WriteBatch(batch, true);
+    if (!EraseRecords(db, 'c'))
+        return error("%s : failed to erase transaction records", __func__);
+
+    LogPrintf("Upgraded %u transactions (%u outputs) to per-output records in %dms\n", nTransactions, nOutputs, GetTimeMillis() - nStart);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -98,6 +292,18 @@ bool CBlockTreeDB::WriteLastBlockFile(int nFile)
     return Write('l', nFile);
 }
 
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, CBlockFileInfo> >& fileInfo, int nLastFile, const std::vector<CDiskBlockIndex>& blockinfo)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator it = fileInfo.begin(); it != fileInfo.end(); it++)
+        batch.Write(make_pair('f', it->first), it->second);
+    if (!fileInfo.empty())
+        batch.Write('l', nLastFile);
+    for (std::vector<CDiskBlockIndex>::const_iterator it = blockinfo.begin(); it != blockinfo.end(); it++)
+        batch.Write(make_pair('b', it->GetBlockHash()), *it);
+    return WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::WriteReindexing(bool fReindexing)
 {
     if (fReindexing)
@@ -123,43 +329,48 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    boost::scoped_ptr<leveldb::Iterator> pcursorOutputs(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'h';
+    pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size()));
 
+    // Hash each transaction as it would have been serialized as one record,
+    // so the result does not depend on the database layout.
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    std::vector<CTxOut> vout;
+    while (pcursor->Valid() && pcursor->key()[0] == 'h') {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+            uint256 txhash;
+            ssKey >> chType >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsHeader header;
+            ssValue >> header;
+            ss << txhash;
+            ss << VARINT(header.nVersion);
+            ss << (header.fCoinBase ? 'c' : 'n');
+            ss << VARINT(header.nHeight);
+            stats.nTransactions++;
+            stats.nSerializedSize += 32 + slValue.size();
+            ReadCoinsOutputs(pcursorOutputs.get(), txhash, vout);
+            for (unsigned int i = 0; i < vout.size(); i++) {
+                const CTxOut& out = vout[i];
+                if (!out.IsNull()) {
+                    stats.nTransactionOutputs++;
+                    stats.nSerializedSize += 4 + ::GetSerializeSize(CTxOutCompressor(REF(out)), SER_DISK, CLIENT_VERSION);
+                    ss << VARINT(i + 1);
+                    ss << out;
+                    nTotalAmount += out.nValue;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
+            ss << VARINT(0);
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -208,89 +419,260 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+namespace {
+
+//! Block index entry as read from disk, with the hash of its header
+typedef std::pair<uint256, CDiskBlockIndex> CDecodedBlockIndex;
+
+boost::filesystem::path GetBlockIndexSnapshotPath()
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
 
+/**
+ * Decode the block index entries whose hash starts with a byte in [nBegin, nEnd),
+ * checking the proof of work of PoW era blocks. Run by the loader threads, each on
+ * its own LevelDB iterator.
+ */
+void DecodeBlockIndexRange(CBlockTreeDB* pdb, int nBegin, int nEnd, std::vector<CDecodedBlockIndex>& vIndex, std::string& strError)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
+
+    uint256 hashStart;
+    *hashStart.begin() = nBegin;
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
+    ssKeySet << make_pair('b', hashStart);
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //zerocoin
-                pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+            if (slKey.size() < 2 || slKey[0] != 'b' || (unsigned char)slKey[1] >= nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+
+            uint256 hash = diskindex.GetBlockHash();
+            if (diskindex.nHeight <= Params().LAST_POW_BLOCK() && !CheckProofOfWork(hash, diskindex.nBits)) {
+                strError = strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+                return;
+            }
+            vIndex.push_back(std::make_pair(hash, diskindex));
+
+            pcursor->Next();
+        } catch (std::exception& e) {
+            strError = strprintf("Deserialize or I/O error - %s", e.what());
+            return;
+        }
+    }
+}
 
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    //Don't load any checkpoints that exist before v2 zpiv. The accumulator is invalid for v1 and not used.
-                    if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
-                        LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
+bool ReadBlockIndexSnapshot(const uint256& nSnapshotId, const uint256& hashBestChain, std::vector<CDecodedBlockIndex>& vIndex)
+{
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    FILE* file = fopen(pathSnapshot.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathSnapshot.string());
+
+    // read data and checksum from file
+    uint64_t fileSize = boost::filesystem::file_size(pathSnapshot);
+    if (fileSize < sizeof(uint256))
+        return error("%s : File %s is truncated", __func__, pathSnapshot.string());
+    std::vector<unsigned char> vchData(fileSize - sizeof(uint256));
+    uint256 hashIn;
+    try {
+        filein.read((char*)begin_ptr(vchData), vchData.size());
+        filein >> hashIn;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    CDataStream ssIndex(vchData, SER_DISK, CLIENT_VERSION);
+    if (hashIn != Hash(ssIndex.begin(), ssIndex.end()))
+        return error("%s : Checksum mismatch, data corrupted", __func__);
+
+    uint256 nSnapshotIdIn;
+    uint256 hashBestChainIn;
+    try {
+        ssIndex >> nSnapshotIdIn >> hashBestChainIn;
+        if (nSnapshotIdIn != nSnapshotId || hashBestChainIn != hashBestChain)
+            return error("%s : Snapshot does not match the block index database", __func__);
+        ssIndex >> vIndex;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
 
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
+    return true;
+}
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
-            }
-        } catch (std::exception& e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+bool CompareDecodedByHeight(const CDecodedBlockIndex* a, const CDecodedBlockIndex* b)
+{
+    return a->second.nHeight < b->second.nHeight;
+}
+
+/**
+ * Single threaded pass that creates and links the CBlockIndex objects of decoded
+ * entries. Going by height creates every entry after its parent, so they are laid
+ * out in height order rather than as placeholders created in hash order.
+ */
+void LinkBlockIndex(const std::vector<const CDecodedBlockIndex*>& vIndex)
+{
+    uint256 nPreviousCheckpoint;
+    for (const CDecodedBlockIndex* pitem : vIndex) {
+        boost::this_thread::interruption_point();
+        const CDecodedBlockIndex& item = *pitem;
+        const CDiskBlockIndex& diskindex = item.second;
+
+        // Construct block index object
+        CBlockIndex* pindexNew = InsertBlockIndex(item.first);
+        pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
+        pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
+        pindexNew->nHeight = diskindex.nHeight;
+        pindexNew->nFile = diskindex.nFile;
+        pindexNew->nDataPos = diskindex.nDataPos;
+        pindexNew->nUndoPos = diskindex.nUndoPos;
+        pindexNew->nVersion = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime = diskindex.nTime;
+        pindexNew->nBits = diskindex.nBits;
+        pindexNew->nNonce = diskindex.nNonce;
+        pindexNew->nStatus = diskindex.nStatus;
+        pindexNew->nTx = diskindex.nTx;
+
+        //zerocoin
+        pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
+        pindexNew->nZerocoinSupply = diskindex.nZerocoinSupply;
+        pindexNew->nMintsInBlock = diskindex.nMintsInBlock;
+
+        //Proof Of Stake
+        pindexNew->nMint = diskindex.nMint;
+        pindexNew->nMoneySupply = diskindex.nMoneySupply;
+        pindexNew->nFlags = diskindex.nFlags;
+        pindexNew->nStakeModifier = diskindex.nStakeModifier;
+        pindexNew->prevoutStake = diskindex.prevoutStake;
+        pindexNew->nStakeTime = diskindex.nStakeTime;
+        pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+
+        // ppcoin: build setStakeSeen
+        if (pindexNew->IsProofOfStake())
+            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+        //populate accumulator checksum map in memory
+        if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
+            //Don't load any checkpoints that exist before v2 zpiv. The accumulator is invalid for v1 and not used.
+            if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
+                LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
+
+            nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
+        }
+    }
+}
+
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(const uint256& hashBestChain, bool fUseSnapshot)
+{
+    // A snapshot is only valid for the first start after the shutdown that wrote it
+    uint256 nSnapshotId = 0;
+    if (Read('S', nSnapshotId) && !Erase('S', true))
+        return error("%s : Failed to erase block index snapshot id", __func__);
+
+    std::vector<std::vector<CDecodedBlockIndex> > vPartitions;
+    if (fUseSnapshot && nSnapshotId != 0) {
+        vPartitions.resize(1);
+        if (ReadBlockIndexSnapshot(nSnapshotId, hashBestChain, vPartitions[0]))
+            LogPrintf("%s : Loaded %u block index entries from snapshot\n", __func__, vPartitions[0].size());
+        else
+            vPartitions.clear();
+    }
+    if (nSnapshotId != 0)
+        boost::filesystem::remove(GetBlockIndexSnapshotPath());
+
+    if (vPartitions.empty()) {
+        // Decode the entries on several threads, each taking a range of the key space
+        int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCKINDEX_LOAD_THREADS));
+        vPartitions.resize(nThreads);
+        std::vector<std::string> vErrors(nThreads);
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&DecodeBlockIndexRange, this, 256 * i / nThreads, 256 * (i + 1) / nThreads,
+                                                  boost::ref(vPartitions[i]), boost::ref(vErrors[i])));
+        {
+            boost::this_thread::disable_interruption di;
+            threadGroup.join_all();
+        }
+        for (const std::string& strError : vErrors) {
+            if (!strError.empty())
+                return error("LoadBlockIndex() : %s", strError);
         }
     }
 
+    // Load mapBlockIndex
+    std::vector<const CDecodedBlockIndex*> vSorted;
+    for (const std::vector<CDecodedBlockIndex>& vIndex : vPartitions) {
+        for (const CDecodedBlockIndex& item : vIndex)
+            vSorted.push_back(&item);
+    }
+    std::stable_sort(vSorted.begin(), vSorted.end(), CompareDecodedByHeight);
+    LinkBlockIndex(vSorted);
+
     return true;
 }
 
-CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const uint256& hashBestChain)
+{
+    uint256 nSnapshotId = GetRandHash();
+
+    // serialize the block index, checksum data up to that point, then append csum
+    CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+    ssIndex << nSnapshotId << hashBestChain;
+    uint64_t nEntries = 0;
+    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
+        // Entries without status are placeholders for unknown parents, never written to the database
+        if (item.second->nStatus != 0)
+            nEntries++;
+    }
+    WriteCompactSize(ssIndex, nEntries);
+    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
+        if (item.second->nStatus != 0)
+            ssIndex << item.first << CDiskBlockIndex(item.second);
+    }
+    uint256 hash = Hash(ssIndex.begin(), ssIndex.end());
+    ssIndex << hash;
+
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    FILE* file = fopen(pathSnapshot.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathSnapshot.string());
+
+    try {
+        fileout << ssIndex;
+    } catch (std::exception& e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    LogPrintf("%s : Wrote %u block index entries\n", __func__, nEntries);
+    return Write('S', nSnapshotId, true);
+}
+
+static CLevelDBOptions ZerocoinDBOptions(size_t nCacheSize)
+{
+    // Almost all lookups are for serials and pubcoins that have never been
+    // seen, so a denser bloom filter saves most of their disk reads.
+    CLevelDBOptions options(nCacheSize);
+    options.nBloomBits = 16;
+    return options;
+}
+
+CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", ZerocoinDBOptions(nCacheSize), fMemory, fWipe)
 {
 }
 
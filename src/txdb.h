@@ -25,6 +25,12 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Maximum number of threads decoding the block index at startup
+static const int MAX_BLOCKINDEX_LOAD_THREADS = 16;
+//! Default for -blockindexsnapshot
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = false;
+//! Bytes of changes the chainstate upgrade queues before writing them out
+static const size_t COINS_DB_UPGRADE_BATCH_SIZE = 16 << 20;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -40,6 +46,9 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Convert a chainstate with one record per transaction to one record per output
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -58,6 +67,7 @@ public:
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
     bool WriteLastBlockFile(int nFile);
+    bool WriteBatchSync(const std::vector<std::pair<int, CBlockFileInfo> >& fileInfo, int nLastFile, const std::vector<CDiskBlockIndex>& blockinfo);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool& fReindex);
     bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
@@ -66,7 +76,8 @@ public:
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
-    bool LoadBlockIndexGuts();
+    bool LoadBlockIndexGuts(const uint256& hashBestChain, bool fUseSnapshot);
+    bool WriteBlockIndexSnapshot(const uint256& hashBestChain);
 };
 
 /** Zerocoin database (zerocoin/) */
@@ -8,12 +8,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -32,8 +37,13 @@ inline bool AllowFree(double dPriority)
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
-/**
+/** \class CTxMemPoolEntry
+ *
  * CTxMemPool stores these:
+ *
+ * Each entry also tracks the size and fees of itself together with all of
+ * its in-mempool descendants. A transaction can only be evicted together
+ * with its descendants, so the pool is trimmed by that package fee rate.
  */
 class CTxMemPoolEntry
 {
@@ -42,9 +52,18 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Fee adjustment from PrioritiseTransaction
+
+    // Information about descendants of this transaction that are in the
+    // mempool; if we remove this transaction we must remove all of these
+    // descendants as well.
+    uint64_t nCountWithDescendants;  //! number of descendant transactions, including this one
+    uint64_t nSizeWithDescendants;   //! ... and their total size
+    CAmount nModFeesWithDescendants; //! ... and their total fees, including fee deltas
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -54,12 +73,147 @@ public:
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+
+    //! Adjust the descendant state, when descendants are added or removed
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    //! Set the fee delta from PrioritiseTransaction
+    void UpdateFeeDelta(CAmount nNewFeeDelta);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state {
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {
+    }
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_fee_delta {
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+// extracts a TxMemPoolEntry's transaction hash
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
 };
 
-class CMinerPolicyEstimator;
+/** Hashes txids with a per-process salt, so peers cannot aim for one bucket */
+class SaltedTxidHasher
+{
+private:
+    uint256 salt;
+
+public:
+    SaltedTxidHasher();
+
+    size_t operator()(const uint256& txid) const
+    {
+        return txid.GetHash(salt);
+    }
+};
+
+/** \class CompareTxMemPoolEntryByDescendantScore
+ *
+ * Sort an entry by max(fee rate of the entry's tx, fee rate with all its
+ * descendants), lowest first. The first entry is the cheapest package to
+ * evict; descendants pay for their parents, but a parent is never scored
+ * below its own fee rate.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2) {
+            // Evict newer transactions first
+            if (a.GetTime() != b.GetTime())
+                return a.GetTime() > b.GetTime();
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 < f2;
+    }
+
+    // Calculate which score to use for an entry (avoiding division).
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** \class CompareTxMemPoolEntryByScore
+ *
+ * Sort by fee rate of the transaction itself, highest first, which is the
+ * order a block template wants them in.
+ */
+class CompareTxMemPoolEntryByScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2)
+            return b.GetTx().GetHash() < a.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tags
+struct descendant_score {
+};
+struct entry_time {
+};
+struct mining_score {
+};
+
+class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
@@ -97,14 +251,78 @@ class CTxMemPool
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
-    CMinerPolicyEstimator* minerPolicyEstimator;
+    CBlockPolicyEstimator* minerPolicyEstimator;
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // lookup by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
+            // sorted by fee rate with descendants, lowest first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate, highest first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<mining_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByScore> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+    /** Recompute the descendant state of an entry from its descendants */
+    void UpdateDescendantState(txiter entry);
+    /** Unlink the given transactions from the rest of the pool and take
+     *  them out of their ancestors' descendant state */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove);
+    /** Remove a transaction from the pool without touching its relatives */
+    void removeUnchecked(txiter entry);
+
+public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
@@ -120,11 +338,11 @@ public:
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
-    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, bool fCurrentEstimate = true);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
+    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void getTransactions(std::set<uint256>& setTxid);
@@ -137,6 +355,33 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /** Remove a set of transactions from the pool. The set must contain
+     *  all in-pool descendants of its members. */
+    void RemoveStaged(setEntries& stage);
+
+    /** Populate setAncestors with all in-mempool ancestors of entry, not
+     *  including entry itself */
+    void CalculateMemPoolAncestors(txiter entry, setEntries& setAncestors) const;
+
+    /** Populate setDescendants with all in-mempool descendants of entry,
+     *  including entry itself. Entries already in setDescendants are
+     *  assumed to have their descendants there as well. */
+    void CalculateDescendants(txiter entry, setEntries& setDescendants) const;
+
+    /** The minimum fee rate to get into the pool, which may itself not be
+     *  enough to stay in it. Rises when the pool is trimmed to sizelimit
+     *  and decays back to zero once blocks make room again. */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /** Remove transactions from the pool until its dynamic size is <=
+     *  sizelimit, evicting the packages with the lowest descendant fee
+     *  rate first */
+    void TrimToSize(size_t sizelimit);
+
+    /** Expire all transactions (and their dependencies) in the pool older
+     *  than time. Return the number of removed transactions. */
+    int Expire(int64_t time);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -156,12 +401,24 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /** Memory used by the pool and its indexes, what -maxmempool limits */
+    size_t DynamicMemoryUsage() const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
+    /**
+     * Estimate fee rate needed to get into the next nBlocks, falling back to
+     * the lowest target with enough data. Never below the mempool minimum fee.
+     */
+    CFeeRate estimateSmartFee(int nBlocks, int* answerFoundAtBlocks = NULL) const;
+
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
 
+    /** Estimate priority needed to get into the next nBlocks, falling back to later targets */
+    double estimateSmartPriority(int nBlocks, int* answerFoundAtBlocks = NULL) const;
+
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
@@ -11,6 +11,8 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <string>
+
 class CBlock;
 struct CBlockLocator;
 class CBlockIndex;
@@ -45,6 +47,7 @@ protected:
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
 // XX42    virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
+    virtual void ProcessedMasternodeMessage(const std::string &strCommand) {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -73,6 +76,8 @@ struct CMainSignals {
 // XX42    boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+    /** Notifies listeners of a masternode, budget, SwiftX or obfuscation message having been processed */
+    boost::signals2::signal<void (const std::string &)> ProcessedMasternodeMessage;
 };
 
 CMainSignals& GetMainSignals();
@@ -12,7 +12,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70914;
+static const int PROTOCOL_VERSION = 70915;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -27,6 +27,9 @@ static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 70914;
 //! masternodes older than this proto version use old strMessage format for mnannounce
 static const int MIN_PEER_MNANNOUNCE = 70913;
 
+//! masternode, SwiftX and budget messages carry their signed message version starting with this version
+static const int MESSAGE_VERSION_PROTO = 70915;
+
 //! nTime field added to CAddress, starting with this version;
 //! if possible, avoid requesting addresses nodes older than this
 static const int CADDR_TIME_VERSION = 31402;
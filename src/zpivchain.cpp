@@ -6,14 +6,150 @@
 #include "zpivchain.h"
 #include "invalid.h"
 #include "main.h"
+#include "crypto/sha256.h"
+#include "random.h"
 #include "txdb.h"
 #include "ui_interface.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
 // 6 comes from OPCODE (1) + vch.size() (1) + BIGNUM size (4)
 #define SCRIPT_OFFSET 6
 // For Script size (BIGNUM/Uint256 size)
 #define BIGNUM_SIZE   4
 
+namespace {
+
+/**
+ * Verified zerocoin spend cache, to avoid running the zero-knowledge proofs of a
+ * spend twice (once when accepted into the memory pool, and again when the block
+ * containing it is connected). Entries are salted so that an attacker cannot
+ * predict where a spend lands in the set.
+ */
+class CZerocoinSpendCache
+{
+private:
+    uint256 nonce;
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_spendcache;
+
+public:
+    CZerocoinSpendCache()
+    {
+        nonce = GetRandHash();
+    }
+
+    //! Entry is (spend, accumulator checksum, txout hash) plus the accumulator the spend was verified against
+    uint256 ComputeEntry(const CTxIn& txin, const libzerocoin::CoinSpend& spend, const CBigNum& bnAccumulatorValue, bool fV1Params) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << Hash(txin.scriptSig.begin(), txin.scriptSig.end()) << spend.getAccumulatorChecksum()
+           << spend.getTxOutHash() << bnAccumulatorValue << fV1Params;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        return setValid.count(entry) != 0;
+    }
+
+    void Set(const uint256& entry)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxzcspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, like the signature cache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+};
+
+/**
+ * Decoded spend cache. The same spend is deserialized from its scriptSig several
+ * times while a block is validated (block signature, stake, spend checks, supply
+ * updates, wallet), so keep the decoded CoinSpend objects of recently seen inputs.
+ * Entries are immutable and shared; callers get their own copy.
+ */
+class CZerocoinSpendDecodeCache
+{
+private:
+    typedef boost::shared_ptr<const libzerocoin::CoinSpend> CoinSpendPtr;
+    std::map<uint256, CoinSpendPtr> mapSpends;
+    uint64_t nDecodes;
+    CCriticalSection cs_decodecache;
+
+public:
+    CZerocoinSpendDecodeCache() : nDecodes(0) {}
+
+    CoinSpendPtr Get(const CTxIn& txin, bool fV1Params)
+    {
+        uint256 hash;
+        unsigned char fV1 = fV1Params;
+        CSHA256().Write(&fV1, 1).Write(txin.scriptSig.data(), txin.scriptSig.size()).Finalize(hash.begin());
+        {
+            LOCK(cs_decodecache);
+            std::map<uint256, CoinSpendPtr>::iterator it = mapSpends.find(hash);
+            if (it != mapSpends.end())
+                return it->second;
+        }
+
+        // extract the CoinSpend from the txin
+        std::vector<char, zero_after_free_allocator<char> > dataTxIn;
+        dataTxIn.insert(dataTxIn.end(), txin.scriptSig.begin() + BIGNUM_SIZE, txin.scriptSig.end());
+        CDataStream serializedCoinSpend(dataTxIn, SER_NETWORK, PROTOCOL_VERSION);
+
+        libzerocoin::ZerocoinParams* paramsAccumulator = Params().Zerocoin_Params(fV1Params);
+        CoinSpendPtr spend(new libzerocoin::CoinSpend(Params().Zerocoin_Params(true), paramsAccumulator, serializedCoinSpend));
+
+        LOCK(cs_decodecache);
+        nDecodes++;
+        while (mapSpends.size() >= MAX_ZEROCOIN_SPEND_DECODE_CACHE) {
+            std::map<uint256, CoinSpendPtr>::iterator it = mapSpends.lower_bound(GetRandHash());
+            if (it == mapSpends.end())
+                it = mapSpends.begin();
+            mapSpends.erase(it);
+        }
+        mapSpends.insert(std::make_pair(hash, spend));
+        return spend;
+    }
+
+    uint64_t GetDecodeCount()
+    {
+        LOCK(cs_decodecache);
+        return nDecodes;
+    }
+};
+
+CZerocoinSpendDecodeCache spendDecodeCache;
+
+}
+
+bool VerifyZerocoinSpendCached(const CTxIn& txin, const libzerocoin::CoinSpend& spend, const CBigNum& bnAccumulatorValue, bool fV1Params)
+{
+    static CZerocoinSpendCache spendCache;
+
+    uint256 entry = spendCache.ComputeEntry(txin, spend, bnAccumulatorValue, fV1Params);
+    if (spendCache.Get(entry))
+        return true;
+
+    libzerocoin::Accumulator accumulator(Params().Zerocoin_Params(fV1Params), spend.getDenomination(), bnAccumulatorValue);
+    if (!spend.Verify(accumulator))
+        return false;
+
+    spendCache.Set(entry);
+    return true;
+}
+
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, vector<CBigNum>& vValues)
 {
     for (const CTransaction tx : block.vtx) {
@@ -338,15 +474,13 @@ bool RemoveSerialFromDB(const CBigNum& bnSerial)
 
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin)
 {
-    // extract the CoinSpend from the txin
-    std::vector<char, zero_after_free_allocator<char> > dataTxIn;
-    dataTxIn.insert(dataTxIn.end(), txin.scriptSig.begin() + BIGNUM_SIZE, txin.scriptSig.end());
-    CDataStream serializedCoinSpend(dataTxIn, SER_NETWORK, PROTOCOL_VERSION);
-
-    libzerocoin::ZerocoinParams* paramsAccumulator = Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start());
-    libzerocoin::CoinSpend spend(Params().Zerocoin_Params(true), paramsAccumulator, serializedCoinSpend);
+    bool fV1Params = chainActive.Height() < Params().Zerocoin_Block_V2_Start();
+    return *spendDecodeCache.Get(txin, fV1Params);
+}
 
-    return spend;
+uint64_t GetZerocoinSpendDecodeCount()
+{
+    return spendDecodeCache.GetDecodeCount();
 }
 
 bool TxOutToPublicCoin(const CTxOut& txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state)
@@ -22,11 +22,17 @@ class CValidationState;
 class CZerocoinMint;
 class uint256;
 
+//! Default for -maxzcspendcachesize, the number of verified zerocoin spends remembered
+static const unsigned int DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 10000;
+//! Number of decoded zerocoin spends kept so each input is deserialized once
+static const unsigned int MAX_ZEROCOIN_SPEND_DECODE_CACHE = 1000;
+
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vValues);
 bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid);
 void FindMints(std::vector<CMintMeta> vMintsToFind, std::vector<CMintMeta>& vMintsToUpdate, std::vector<CMintMeta>& vMissingMints);
 int GetZerocoinStartHeight();
+uint64_t GetZerocoinSpendDecodeCount();
 bool GetZerocoinMint(const CBigNum& bnPubcoin, uint256& txHash);
 bool IsPubcoinInBlockchain(const uint256& hashPubcoin, uint256& txid);
 bool IsSerialKnown(const CBigNum& bnSerial);
@@ -37,6 +43,7 @@ bool RemoveSerialFromDB(const CBigNum& bnSerial);
 std::string ReindexZerocoinDB();
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut& txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
+bool VerifyZerocoinSpendCached(const CTxIn& txin, const libzerocoin::CoinSpend& spend, const CBigNum& bnAccumulatorValue, bool fV1Params);
 std::list<libzerocoin::CoinDenomination> ZerocoinSpendListFromBlock(const CBlock& block, bool fFilterInvalid);
 
 